@@ -0,0 +1,569 @@
+#ifndef DATAGRAM_LINK_H
+#define DATAGRAM_LINK_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "potato.h"
+#include "network_utils.h"
+
+// Header in front of every datagram, followed by ack_count DatagramAcks.
+// DATA datagrams then carry one complete MessageHeader and payload; ACK
+// datagrams carry only the acknowledgements.
+struct DatagramHeader {
+    int kind;           // DATAGRAM_DATA or DATAGRAM_ACK
+    uint32_t session;   // Sender's session with this peer, random per link
+    uint32_t seq;       // Sequence number of a DATA datagram
+    int ack_count;      // Acknowledgements that follow the header
+
+    typedef FieldList<MESSAGE_FIELD(DatagramHeader, kind),
+                      MESSAGE_FIELD(DatagramHeader, session),
+                      MESSAGE_FIELD(DatagramHeader, seq),
+                      MESSAGE_FIELD(DatagramHeader, ack_count)> Fields;
+
+    static constexpr int HEADER_SIZE = Fields::SIZE;
+};
+
+// Acknowledgement of one DATA datagram received from the peer
+struct DatagramAck {
+    uint32_t session;
+    uint32_t seq;
+
+    typedef FieldList<MESSAGE_FIELD(DatagramAck, session),
+                      MESSAGE_FIELD(DatagramAck, seq)> Fields;
+
+    static constexpr int SIZE = Fields::SIZE;
+};
+
+enum DatagramKind {
+    DATAGRAM_DATA = 1,
+    DATAGRAM_ACK = 2
+};
+
+// Both neighbor links of a player over one UDP socket. Each message is one
+// datagram; the receiver acknowledges every datagram, the sender resends
+// unacknowledged ones with exponential backoff, and the receiver drops
+// duplicates by sequence number. Delivery is not ordered: potatoes are
+// independent of each other.
+//
+// At most WINDOW datagrams per neighbor are unacknowledged at once; later
+// messages wait in a queue, so a burst cannot overrun the neighbor's
+// receive buffer. Resends are paced to RESEND_BURST per millisecond per
+// neighbor rather than fired all at once when many time out together.
+//
+// A neighbor is never given up on here, however lossy its link: a datagram
+// that was never acknowledged may still have been delivered, and passing
+// its potato on another way would put two copies in play. Only the
+// ringmaster decides a player is dead, from its heartbeats; it then repairs
+// the ring and re-injects what the dead player held, and set_neighbors
+// drops what was queued for it here.
+//
+// Acknowledgements are delayed briefly and ride on the next datagram to the
+// same neighbor when there is one, since each separate ack costs the
+// neighbor a wakeup; a potato often goes straight back where it came from.
+class DatagramLink {
+public:
+    // A message delivered by receive()
+    struct Delivery {
+        int peer_id;
+        MessageHeader header;
+        std::vector<char> data;
+    };
+
+private:
+    struct Pending {
+        std::vector<char> datagram;
+        std::chrono::steady_clock::time_point sent;
+        int attempts;
+    };
+
+    struct Peer {
+        int id;
+        sockaddr_storage addr;
+        socklen_t addr_length;
+        uint32_t send_session;
+        uint32_t next_seq;
+        std::map<uint32_t, Pending> unacked;
+        std::deque<std::vector<char> > waiting; // Encoded messages beyond the window
+        std::chrono::steady_clock::time_point resend_after; // Pacing of resends
+        uint32_t receive_session;           // Peer's session we are deduplicating for
+        uint32_t next_expected;             // Every sequence number below was delivered
+        std::set<uint32_t> delivered_ahead; // Delivered sequence numbers above next_expected
+        std::vector<DatagramAck> acks_owed; // Received but not yet acknowledged
+        std::chrono::steady_clock::time_point ack_due;
+    };
+
+    int fd;
+    int family;
+    int port;
+    std::vector<Peer> peers;
+    double loss_rate;                       // Fraction of outgoing datagrams dropped on purpose
+    std::mt19937 rng;
+    long retransmits;
+    long duplicates;
+
+    static const int ACK_DELAY_MS = 2;      // Longest an acknowledgement waits for a ride
+    static const int MAX_ACKS = 64;         // Acknowledgements carried per datagram
+    static const int RETRANSMIT_MS = 20;    // First resend; doubles per attempt
+    static const int MAX_BACKOFF_SHIFT = 3;
+    static const size_t WINDOW = 32;        // Unacknowledged datagrams per neighbor
+    static const int RESEND_BURST = 4;      // Resends per neighbor per millisecond
+    static const int MAX_DATAGRAM = 1 << 16;
+    static const size_t MAX_AHEAD = 4096;   // Bound on the out-of-order set
+
+    static long ms_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    static int retransmit_delay(int attempts) {
+        return RETRANSMIT_MS << std::min(attempts - 1, static_cast<int>(MAX_BACKOFF_SHIFT));
+    }
+
+    // Address of a peer in the form this socket sends to and receives from:
+    // IPv4 addresses become IPv4-mapped on a dual-stack IPv6 socket
+    ResolvedAddress socket_address(const ResolvedAddress& address) const {
+        if (family != AF_INET6 || address.family != AF_INET) {
+            return address;
+        }
+        const sockaddr_in* addr4 = reinterpret_cast<const sockaddr_in*>(&address.addr);
+        ResolvedAddress mapped;
+        memset(&mapped.addr, 0, sizeof(mapped.addr));
+        sockaddr_in6* addr6 = reinterpret_cast<sockaddr_in6*>(&mapped.addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = addr4->sin_port;
+        addr6->sin6_addr.s6_addr[10] = 0xff;
+        addr6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&addr6->sin6_addr.s6_addr[12], &addr4->sin_addr, 4);
+        mapped.length = sizeof(sockaddr_in6);
+        mapped.family = AF_INET6;
+        return mapped;
+    }
+
+    static bool same_address(const sockaddr_storage& a, const sockaddr_storage& b) {
+        if (a.ss_family != b.ss_family) {
+            return false;
+        }
+        if (a.ss_family == AF_INET6) {
+            const sockaddr_in6* a6 = reinterpret_cast<const sockaddr_in6*>(&a);
+            const sockaddr_in6* b6 = reinterpret_cast<const sockaddr_in6*>(&b);
+            return a6->sin6_port == b6->sin6_port &&
+                   memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+        }
+        const sockaddr_in* a4 = reinterpret_cast<const sockaddr_in*>(&a);
+        const sockaddr_in* b4 = reinterpret_cast<const sockaddr_in*>(&b);
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+
+    Peer* find_peer(int id) {
+        for (Peer& peer : peers) {
+            if (peer.id == id) {
+                return &peer;
+            }
+        }
+        return nullptr;
+    }
+
+    Peer* find_peer(const sockaddr_storage& addr) {
+        for (Peer& peer : peers) {
+            if (same_address(peer.addr, addr)) {
+                return &peer;
+            }
+        }
+        return nullptr;
+    }
+
+    // Send one datagram, unless loss injection eats it
+    void transmit(const Peer& peer, const std::vector<char>& datagram) {
+        if (loss_rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < loss_rate) {
+            return;
+        }
+        // A full socket buffer is just another lost datagram
+        sendto(fd, datagram.data(), datagram.size(), 0,
+               reinterpret_cast<const sockaddr*>(&peer.addr), peer.addr_length);
+    }
+
+    // Start a datagram for peer in datagram: header plus up to MAX_ACKS of the
+    // acknowledgements owed to it. Returns the offset just past the acks.
+    static int write_header(Peer& peer, int kind, uint32_t seq, int payload_size,
+                            std::vector<char>& datagram) {
+        int acks = std::min(static_cast<int>(peer.acks_owed.size()), static_cast<int>(MAX_ACKS));
+        int offset = DatagramHeader::HEADER_SIZE + acks * DatagramAck::SIZE;
+        datagram.resize(offset + payload_size);
+
+        DatagramHeader header;
+        header.kind = kind;
+        header.session = peer.send_session;
+        header.seq = seq;
+        header.ack_count = acks;
+        DatagramHeader::Fields::write(header, datagram.data());
+
+        std::vector<DatagramAck>::iterator end = peer.acks_owed.begin() + acks;
+        char* position = datagram.data() + DatagramHeader::HEADER_SIZE;
+        for (std::vector<DatagramAck>::iterator it = peer.acks_owed.begin(); it != end; ++it) {
+            DatagramAck::Fields::write(*it, position);
+            position += DatagramAck::SIZE;
+        }
+        peer.acks_owed.erase(peer.acks_owed.begin(), end);
+        return offset;
+    }
+
+    // Send owed acknowledgements on their own once they have waited long enough
+    void flush_acks(Peer& peer) {
+        while (!peer.acks_owed.empty()) {
+            std::vector<char> datagram;
+            write_header(peer, DATAGRAM_ACK, 0, 0, datagram);
+            transmit(peer, datagram);
+        }
+    }
+
+    // Give an encoded message (MessageHeader and payload) the next sequence
+    // number and send it
+    void send_now(Peer& peer, const std::vector<char>& message) {
+        uint32_t seq = peer.next_seq++;
+        // A resend repeats the piggybacked acks, which the peer ignores by then
+        Pending& pending = peer.unacked[seq];
+        int offset = write_header(peer, DATAGRAM_DATA, seq, message.size(), pending.datagram);
+        memcpy(pending.datagram.data() + offset, message.data(), message.size());
+        pending.sent = std::chrono::steady_clock::now();
+        pending.attempts = 1;
+        transmit(peer, pending.datagram);
+    }
+
+    // Send waiting messages while the window has room
+    void fill_window(Peer& peer) {
+        while (!peer.waiting.empty() && peer.unacked.size() < WINDOW) {
+            send_now(peer, peer.waiting.front());
+            peer.waiting.pop_front();
+        }
+    }
+
+    // Start over with a fresh session: whatever was in flight or waiting is
+    // dropped, and the peer resets its duplicate tracking on the new session
+    void reset_sending(Peer& peer) {
+        peer.send_session = rng();
+        peer.next_seq = 1;
+        peer.unacked.clear();
+        peer.waiting.clear();
+        peer.resend_after = std::chrono::steady_clock::time_point();
+    }
+
+    void owe_ack(Peer& peer, uint32_t session, uint32_t seq) {
+        if (peer.acks_owed.empty()) {
+            peer.ack_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(ACK_DELAY_MS));
+        }
+        DatagramAck ack;
+        ack.session = session;
+        ack.seq = seq;
+        peer.acks_owed.push_back(ack);
+    }
+
+    // Record seq from the peer's current session; returns false for a duplicate.
+    // Every datagram is resent until acknowledged, so gaps below the
+    // out-of-order set always close and the set stays as small as the
+    // number of datagrams in flight.
+    static bool accept_seq(Peer& peer, uint32_t session, uint32_t seq) {
+        if (session != peer.receive_session) {
+            peer.receive_session = session;
+            peer.next_expected = 1;
+            peer.delivered_ahead.clear();
+        }
+        if (seq < peer.next_expected || !peer.delivered_ahead.insert(seq).second) {
+            return false;
+        }
+        while (!peer.delivered_ahead.empty() &&
+               (*peer.delivered_ahead.begin() == peer.next_expected ||
+                peer.delivered_ahead.size() > MAX_AHEAD)) {
+            peer.next_expected = *peer.delivered_ahead.begin() + 1;
+            peer.delivered_ahead.erase(peer.delivered_ahead.begin());
+        }
+        return true;
+    }
+
+public:
+    DatagramLink()
+        : fd(-1), family(AF_INET6), port(0), loss_rate(0), retransmits(0), duplicates(0) {
+        std::random_device rd;
+        rng.seed(rd());
+    }
+
+    DatagramLink(const DatagramLink&) = delete;
+    DatagramLink& operator=(const DatagramLink&) = delete;
+
+    ~DatagramLink() {
+        close_socket();
+    }
+
+    bool is_open() const { return fd >= 0; }
+
+    int get_fd() const { return fd; }
+
+    int get_port() const { return port; }
+
+    long get_retransmits() const { return retransmits; }
+
+    long get_duplicates() const { return duplicates; }
+
+    // Messages for a peer that it has not acknowledged yet, sent or waiting
+    int unacked_count(int peer_id) {
+        Peer* peer = find_peer(peer_id);
+        return peer != nullptr ? static_cast<int>(peer->unacked.size() + peer->waiting.size()) : 0;
+    }
+
+    // Drop this fraction of outgoing datagrams, to exercise the retransmits
+    void set_loss_rate(double rate) { loss_rate = rate; }
+
+    // Bind a non-blocking UDP socket to an automatically assigned port,
+    // dual-stack IPv6 where available
+    void open() {
+        fd = socket(AF_INET6, SOCK_DGRAM, 0);
+        family = AF_INET6;
+        if (fd < 0) {
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+            family = AF_INET;
+        }
+        if (fd < 0) {
+            throw NetworkError("Failed to create datagram socket");
+        }
+
+        sockaddr_storage address;
+        memset(&address, 0, sizeof(address));
+        socklen_t length;
+        if (family == AF_INET6) {
+            int v6only = 0;
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+            sockaddr_in6* addr6 = reinterpret_cast<sockaddr_in6*>(&address);
+            addr6->sin6_family = AF_INET6;
+            addr6->sin6_addr = in6addr_any;
+            length = sizeof(sockaddr_in6);
+        } else {
+            sockaddr_in* addr4 = reinterpret_cast<sockaddr_in*>(&address);
+            addr4->sin_family = AF_INET;
+            addr4->sin_addr.s_addr = INADDR_ANY;
+            length = sizeof(sockaddr_in);
+        }
+
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) < 0 ||
+            getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) < 0) {
+            close_socket();
+            throw NetworkError("Failed to bind datagram socket");
+        }
+        port = family == AF_INET6 ? ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port)
+                                  : ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void close_socket() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // Point the link at the given neighbors. A neighbor that is kept keeps
+    // its receive state, so its in-flight datagrams are still acknowledged
+    // and deduplicated. What we were sending it belongs to the epoch the
+    // repair ended and is dropped.
+    void set_neighbors(const NeighborInfo& neighbors) {
+        std::vector<Peer> updated;
+        const int ids[2] = {neighbors.left_id, neighbors.right_id};
+        const char* ips[2] = {neighbors.left_ip, neighbors.right_ip};
+        const int ports[2] = {neighbors.left_port, neighbors.right_port};
+
+        for (int side = 0; side < 2; side++) {
+            if (side == 1 && ids[1] == ids[0]) {
+                break;  // Two-player ring: both neighbors are the same player
+            }
+            ResolvedAddress address;
+            try {
+                address = socket_address(Resolver::instance().resolve(ips[side], ports[side])[0]);
+            } catch (const ResolverError& e) {
+                throw NetworkError(e.what());
+            }
+
+            Peer* existing = find_peer(ids[side]);
+            if (existing != nullptr && same_address(existing->addr, address.addr)) {
+                updated.push_back(*existing);
+                reset_sending(updated.back());
+                continue;
+            }
+            Peer peer;
+            peer.id = ids[side];
+            peer.addr = address.addr;
+            peer.addr_length = address.length;
+            peer.receive_session = 0;
+            peer.next_expected = 1;
+            reset_sending(peer);
+            updated.push_back(peer);
+        }
+        peers.swap(updated);
+    }
+
+    // Send a message to a neighbor; false if it is not a current neighbor
+    template <MessageType Type>
+    bool send(int peer_id, const typename MessagePayload<Type>::type& payload) {
+        Peer* peer = find_peer(peer_id);
+        if (peer == nullptr) {
+            return false;
+        }
+
+        typedef MessageCodec<typename MessagePayload<Type>::type> Codec;
+        int size = Codec::size(payload);
+        if (DatagramHeader::HEADER_SIZE + MAX_ACKS * DatagramAck::SIZE +
+            MessageHeader::HEADER_SIZE + size > MAX_DATAGRAM) {
+            throw NetworkError("Message too large for a datagram");
+        }
+
+        std::vector<char> message;
+        NetworkUtils::encode<Type>(payload, message);
+        if (peer->unacked.size() < WINDOW && peer->waiting.empty()) {
+            send_now(*peer, message);
+        } else {
+            peer->waiting.push_back(message);
+        }
+        return true;
+    }
+
+    // Read every datagram waiting on the socket. Acknowledgements are
+    // consumed here; new messages from known neighbors are returned.
+    std::vector<Delivery> receive() {
+        std::vector<Delivery> deliveries;
+        static thread_local std::vector<char> buffer(MAX_DATAGRAM);
+
+        while (true) {
+            sockaddr_storage from;
+            socklen_t from_length = sizeof(from);
+            ssize_t received = recvfrom(fd, buffer.data(), buffer.size(), 0,
+                                        reinterpret_cast<sockaddr*>(&from), &from_length);
+            if (received < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;  // EAGAIN: drained; anything else is transient for UDP
+            }
+
+            Peer* peer = find_peer(from);
+            if (peer == nullptr || received < DatagramHeader::HEADER_SIZE) {
+                continue;  // Stray datagram, e.g. from a neighbor replaced by a repair
+            }
+
+            DatagramHeader datagram_header;
+            DatagramHeader::Fields::read(datagram_header, buffer.data());
+            int offset = DatagramHeader::HEADER_SIZE + datagram_header.ack_count * DatagramAck::SIZE;
+            if (datagram_header.ack_count < 0 || datagram_header.ack_count > MAX_ACKS || received < offset) {
+                continue;
+            }
+
+            const char* position = buffer.data() + DatagramHeader::HEADER_SIZE;
+            for (int i = 0; i < datagram_header.ack_count; i++) {
+                DatagramAck ack;
+                DatagramAck::Fields::read(ack, position);
+                position += DatagramAck::SIZE;
+                if (ack.session == peer->send_session) {
+                    peer->unacked.erase(ack.seq);
+                }
+            }
+            fill_window(*peer);
+
+            if (datagram_header.kind != DATAGRAM_DATA || received < offset + MessageHeader::HEADER_SIZE) {
+                continue;
+            }
+
+            // Acknowledge even duplicates: the earlier ack may have been lost
+            owe_ack(*peer, datagram_header.session, datagram_header.seq);
+            if (!accept_seq(*peer, datagram_header.session, datagram_header.seq)) {
+                duplicates++;
+                continue;
+            }
+
+            Delivery delivery;
+            delivery.peer_id = peer->id;
+            const char* message = buffer.data() + offset;
+            MessageHeader::Fields::read(delivery.header, message);
+            int payload_size = received - offset - MessageHeader::HEADER_SIZE;
+            if (delivery.header.size != payload_size) {
+                continue;
+            }
+            delivery.data.assign(message + MessageHeader::HEADER_SIZE, message + MessageHeader::HEADER_SIZE + payload_size);
+            deliveries.push_back(delivery);
+        }
+
+        return deliveries;
+    }
+
+    // Send acknowledgements that found no ride in time and resend datagrams
+    // whose acknowledgement is overdue, RESEND_BURST at a time. Resends go
+    // on at the longest backoff until the neighbor acknowledges or a ring
+    // repair replaces it.
+    void on_timer() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (Peer& peer : peers) {
+            if (!peer.acks_owed.empty() && now >= peer.ack_due) {
+                flush_acks(peer);
+            }
+            if (now < peer.resend_after) {
+                continue;
+            }
+
+            int resent = 0;
+            std::map<uint32_t, Pending>::iterator it = peer.unacked.begin();
+            while (it != peer.unacked.end() && resent < RESEND_BURST) {
+                Pending& pending = it->second;
+                if (ms_since(pending.sent) < retransmit_delay(pending.attempts)) {
+                    ++it;
+                    continue;
+                }
+                pending.attempts++;
+                pending.sent = now;
+                retransmits++;
+                resent++;
+                transmit(peer, pending.datagram);
+                ++it;
+            }
+            if (resent == RESEND_BURST) {
+                peer.resend_after = now + std::chrono::milliseconds(1);
+            }
+        }
+    }
+
+    // Milliseconds until on_timer() has work to do, -1 if nothing is pending
+    int next_timeout_ms() const {
+        int next = -1;
+        for (const Peer& peer : peers) {
+            if (!peer.acks_owed.empty()) {
+                long due_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    peer.ack_due - std::chrono::steady_clock::now()).count();
+                int due = std::max(0L, (due_us + 999) / 1000);
+                if (next < 0 || due < next) {
+                    next = due;
+                }
+            }
+            // Resends wait out the pacing gap
+            long paced_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                peer.resend_after - std::chrono::steady_clock::now()).count();
+            long paced = std::max(0L, (paced_us + 999) / 1000);
+            for (const auto& entry : peer.unacked) {
+                int due = std::max(paced, retransmit_delay(entry.second.attempts) - ms_since(entry.second.sent));
+                if (next < 0 || due < next) {
+                    next = due;
+                }
+            }
+        }
+        return next;
+    }
+};
+
+#endif // DATAGRAM_LINK_H
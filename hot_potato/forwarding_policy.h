@@ -0,0 +1,152 @@
+#ifndef FORWARDING_POLICY_H
+#define FORWARDING_POLICY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+
+// Which neighbor a potato is passed to
+enum Direction {
+    DIRECTION_LEFT = 0,
+    DIRECTION_RIGHT = 1
+};
+
+// Policy names, as sent to the players in SetupInfo
+enum ForwardingPolicyKind {
+    POLICY_RANDOM = 0,        // Fair coin (the original behavior)
+    POLICY_POWER_OF_TWO = 1,  // Less loaded of the two neighbors
+    POLICY_LEAST_RECENT = 2   // Neighbor sent to least recently
+};
+
+// What a player knows about one neighbor when forwarding
+struct NeighborLoad {
+    int hint;             // Backlog the neighbor reported on its last potato to us
+    int sent_since_hint;  // Potatoes sent to it since that report
+    int hops_since_hint;  // Potatoes this player has handled since that report
+    int outbound;         // Potatoes queued towards the neighbor, not yet taken
+    long last_sent;       // Forwarding count when we last sent to it, -1 if never
+
+    NeighborLoad() : hint(0), sent_since_hint(0), hops_since_hint(0), outbound(0), last_sent(-1) {}
+
+    void note_hint(int backlog) {
+        hint = backlog;
+        sent_since_hint = 0;
+        hops_since_hint = 0;
+    }
+
+    void note_sent(long forwarded) {
+        last_sent = forwarded;
+        sent_since_hint++;
+    }
+
+    void note_hop() {
+        hops_since_hint++;
+    }
+
+    // The neighbor's backlog as of its last report, worked off at about this
+    // player's own pace since, plus what we have sent it after. What is
+    // still queued towards it is fresh, so it counts again on top.
+    int load() const {
+        return std::max(0, hint - hops_since_hint) + sent_since_hint + outbound;
+    }
+};
+
+// Chooses the neighbor each potato goes to. If that neighbor's link is down
+// the player falls back to the other one, whatever the policy said.
+class ForwardingPolicy {
+public:
+    virtual ~ForwardingPolicy() {}
+
+    virtual Direction choose(const NeighborLoad& left, const NeighborLoad& right, std::mt19937& rng) = 0;
+
+    // Whether choose() looks at load; if not, nobody measures it
+    virtual bool uses_load() const { return false; }
+
+    static std::unique_ptr<ForwardingPolicy> create(int kind);
+
+    // Parse a command-line policy name; returns false if it is unknown
+    static bool parse_kind(const std::string& name, int* kind) {
+        if (name == "random") {
+            *kind = POLICY_RANDOM;
+        } else if (name == "power-of-two") {
+            *kind = POLICY_POWER_OF_TWO;
+        } else if (name == "least-recent") {
+            *kind = POLICY_LEAST_RECENT;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+protected:
+    ForwardingPolicy() : coin_bits(0), coin_bits_left(0) {}
+
+    // Fair coin. One draw from rng gives 32 flips, so a hop rarely pays
+    // for the generator.
+    Direction coin(std::mt19937& rng) {
+        if (coin_bits_left == 0) {
+            coin_bits = static_cast<uint32_t>(rng());
+            coin_bits_left = 32;
+        }
+        Direction side = (coin_bits & 1) ? DIRECTION_RIGHT : DIRECTION_LEFT;
+        coin_bits >>= 1;
+        coin_bits_left--;
+        return side;
+    }
+
+private:
+    uint32_t coin_bits;   // Flips left over from the last draw
+    int coin_bits_left;
+};
+
+// Left or right with equal probability, regardless of load
+class UniformRandomPolicy : public ForwardingPolicy {
+public:
+    Direction choose(const NeighborLoad&, const NeighborLoad&, std::mt19937& rng) override {
+        return coin(rng);
+    }
+};
+
+// Power of two choices: with exactly two candidates this is simply the less
+// loaded neighbor, ties broken at random. The outbound queue is only visible
+// where the kernel holds what the neighbor has not read: direct unix links
+// and UDP. A TCP socket reports unacknowledged bytes, about zero on a fast
+// network, and the relay drains mux links at once, so there the choice rests
+// on the neighbors' reports and what was sent since.
+class PowerOfTwoPolicy : public ForwardingPolicy {
+public:
+    Direction choose(const NeighborLoad& left, const NeighborLoad& right, std::mt19937& rng) override {
+        if (left.load() != right.load()) {
+            return left.load() < right.load() ? DIRECTION_LEFT : DIRECTION_RIGHT;
+        }
+        return coin(rng);
+    }
+
+    bool uses_load() const override { return true; }
+};
+
+// Alternate between neighbors: whichever was sent to least recently
+class LeastRecentlySentPolicy : public ForwardingPolicy {
+public:
+    Direction choose(const NeighborLoad& left, const NeighborLoad& right, std::mt19937& rng) override {
+        if (left.last_sent != right.last_sent) {
+            return left.last_sent < right.last_sent ? DIRECTION_LEFT : DIRECTION_RIGHT;
+        }
+        return coin(rng);
+    }
+};
+
+inline std::unique_ptr<ForwardingPolicy> ForwardingPolicy::create(int kind) {
+    switch (kind) {
+        case POLICY_POWER_OF_TWO:
+            return std::unique_ptr<ForwardingPolicy>(new PowerOfTwoPolicy());
+        case POLICY_LEAST_RECENT:
+            return std::unique_ptr<ForwardingPolicy>(new LeastRecentlySentPolicy());
+        default:
+            return std::unique_ptr<ForwardingPolicy>(new UniformRandomPolicy());
+    }
+}
+
+#endif // FORWARDING_POLICY_H
@@ -0,0 +1,264 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// Log levels, lowest to highest severity. LOG_LEVEL_OFF disables all output.
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_WARN = 2,
+    LOG_LEVEL_ERROR = 3,
+    LOG_LEVEL_OFF = 4
+};
+
+// Log a printf-style message at the given level. The level check is done
+// before any formatting so disabled messages cost one relaxed load.
+#define LOG_MSG(level, ...) \
+    do { \
+        if (Logger::instance().enabled(level)) { \
+            Logger::instance().log(__VA_ARGS__); \
+        } \
+    } while (0)
+
+// Single-producer/single-consumer ring of fixed-size text records.
+// Each thread that logs owns one ring; the flusher thread is the only consumer.
+struct LogRing {
+    static const size_t SLOT_COUNT = 1024;  // Must be a power of two
+    static const size_t SLOT_SIZE = 128;    // Bytes per formatted message
+
+    struct Slot {
+        unsigned short length;
+        char text[SLOT_SIZE];
+    };
+
+    std::atomic<size_t> head;  // Next slot the producer writes
+    std::atomic<size_t> tail;  // Next slot the consumer reads
+    Slot slots[SLOT_COUNT];
+
+    LogRing() : head(0), tail(0) {}
+};
+
+// Asynchronous logger: producers format into their per-thread ring without
+// locking and a background thread batches the records into large writes.
+class Logger {
+private:
+    std::atomic<int> min_level;
+    std::atomic<bool> stopping;
+    std::mutex rings_mutex;                      // Guards the ring registry only
+    std::vector<std::unique_ptr<LogRing> > rings;
+    std::mutex write_mutex;                      // Held while a batch is drained and written
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool woken;                                  // Guarded by wake_mutex
+    std::atomic<bool> idle;                      // Flusher found nothing for IDLE_POLLS polls
+    std::thread flusher;
+    int out_fd;
+
+    // While records keep arriving the flusher polls every POLL_INTERVAL and
+    // producers leave it alone. After IDLE_POLLS empty polls it goes idle and
+    // the next record wakes it.
+    static const int IDLE_POLLS = 10;
+    static std::chrono::milliseconds poll_interval() { return std::chrono::milliseconds(10); }
+    static std::chrono::milliseconds idle_wait() { return std::chrono::milliseconds(100); }
+
+    Logger() : min_level(LOG_LEVEL_INFO), stopping(false), woken(false), idle(false), out_fd(STDOUT_FILENO) {
+        flusher = std::thread(&Logger::flush_loop, this);
+    }
+
+    // Get (and lazily register) the calling thread's ring
+    LogRing& local_ring() {
+        static thread_local LogRing* ring = nullptr;
+        if (ring == nullptr) {
+            std::unique_ptr<LogRing> created(new LogRing());
+            ring = created.get();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.push_back(std::move(created));
+        }
+        return *ring;
+    }
+
+    // Move every pending record into the batch buffer, returning the count
+    size_t drain(std::string& batch) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        size_t drained = 0;
+        for (size_t r = 0; r < rings.size(); r++) {
+            LogRing& ring = *rings[r];
+            size_t tail = ring.tail.load(std::memory_order_relaxed);
+            size_t head = ring.head.load(std::memory_order_acquire);
+            while (tail != head) {
+                const LogRing::Slot& slot = ring.slots[tail & (LogRing::SLOT_COUNT - 1)];
+                batch.append(slot.text, slot.length);
+                tail++;
+                drained++;
+            }
+            ring.tail.store(tail, std::memory_order_release);
+        }
+        return drained;
+    }
+
+    // Write the whole batch, retrying on short writes
+    void write_batch(std::string& batch) {
+        const char* ptr = batch.data();
+        size_t remaining = batch.size();
+        while (remaining > 0) {
+            ssize_t written = ::write(out_fd, ptr, remaining);
+            if (written <= 0) {
+                break;
+            }
+            ptr += written;
+            remaining -= written;
+        }
+        batch.clear();
+    }
+
+    // True if any ring has records the flusher has not taken yet
+    bool pending() {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (size_t r = 0; r < rings.size(); r++) {
+            if (rings[r]->head.load(std::memory_order_relaxed) != rings[r]->tail.load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Wake the flusher now rather than at its next poll
+    void wake_flusher() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            woken = true;
+            idle.store(false, std::memory_order_relaxed);
+        }
+        wake.notify_one();
+    }
+
+    // Drain whenever there is work; otherwise wait for the next poll, or for
+    // a wakeup once idle. The fence pairs with the producer's check of idle
+    // in log(); a record that races with going idle is still picked up when
+    // the idle wait times out.
+    void flush_loop() {
+        std::string batch;
+        int empty_polls = 0;
+        while (true) {
+            bool stop = stopping.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                if (drain(batch) > 0) {
+                    write_batch(batch);
+                    empty_polls = 0;
+                    continue;
+                }
+            }
+            if (stop) {
+                break;
+            }
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            bool going_idle = ++empty_polls >= IDLE_POLLS;
+            if (going_idle) {
+                idle.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (pending()) {
+                    idle.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            wake.wait_for(lock, going_idle ? idle_wait() : poll_interval(), [this] { return woken; });
+            woken = false;
+            idle.store(false, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    ~Logger() {
+        stopping.store(true, std::memory_order_release);
+        wake_flusher();
+        if (flusher.joinable()) {
+            flusher.join();
+        }
+    }
+
+    void set_level(LogLevel level) { min_level.store(level, std::memory_order_relaxed); }
+
+    LogLevel get_level() const { return static_cast<LogLevel>(min_level.load(std::memory_order_relaxed)); }
+
+    bool enabled(LogLevel level) const {
+        return level != LOG_LEVEL_OFF && level >= min_level.load(std::memory_order_relaxed);
+    }
+
+    // Format a message (a trailing newline is appended) into this thread's ring
+    void log(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        LogRing& ring = local_ring();
+        size_t head = ring.head.load(std::memory_order_relaxed);
+
+        // Ring full: apply backpressure rather than dropping output
+        while (head - ring.tail.load(std::memory_order_acquire) >= LogRing::SLOT_COUNT) {
+            wake_flusher();
+            std::this_thread::yield();
+        }
+
+        LogRing::Slot& slot = ring.slots[head & (LogRing::SLOT_COUNT - 1)];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(slot.text, LogRing::SLOT_SIZE - 1, format, args);
+        va_end(args);
+
+        if (length < 0) {
+            length = 0;
+        } else if (length > static_cast<int>(LogRing::SLOT_SIZE) - 2) {
+            length = LogRing::SLOT_SIZE - 2;  // Truncated by vsnprintf
+        }
+        slot.text[length] = '\n';
+        slot.length = static_cast<unsigned short>(length + 1);
+
+        ring.head.store(head + 1, std::memory_order_release);
+
+        // Wake the flusher only for the first record after it went idle or
+        // when this ring reaches half full; otherwise its next poll takes it
+        if (idle.load(std::memory_order_relaxed) ||
+            head + 1 - ring.tail.load(std::memory_order_relaxed) == LogRing::SLOT_COUNT / 2) {
+            wake_flusher();
+        }
+    }
+
+    // Block until everything logged so far by this thread has been written
+    void flush() {
+        LogRing& ring = local_ring();
+        size_t head = ring.head.load(std::memory_order_relaxed);
+        while (ring.tail.load(std::memory_order_acquire) != head) {
+            wake_flusher();
+            std::this_thread::yield();
+        }
+        // Wait out a batch that was drained but may not be written yet
+        std::lock_guard<std::mutex> lock(write_mutex);
+    }
+
+    // Parse a level name ("debug", "info", "warn", "error", "off")
+    static bool parse_level(const std::string& name, LogLevel* level) {
+        static const char* const names[] = { "debug", "info", "warn", "error", "off" };
+        for (int i = 0; i <= LOG_LEVEL_OFF; i++) {
+            if (name == names[i]) {
+                *level = static_cast<LogLevel>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif // LOGGER_H
@@ -0,0 +1,110 @@
+#ifndef MESSAGE_CODEC_H
+#define MESSAGE_CODEC_H
+
+#include <cstddef>
+#include <cstring>
+
+// Building blocks for messages whose wire layout is generated at compile time.
+// A message lists its fields once:
+//
+//     struct Example {
+//         int a;
+//         char name[16];
+//         typedef FieldList<MESSAGE_FIELD(Example, a),
+//                           MESSAGE_FIELD(Example, name)> Fields;
+//     };
+//
+// and FixedCodec<Example> then knows its size and how to encode it. Offsets
+// are template constants, so encoding is a straight run of memcpy calls.
+
+// Received strings are always NUL-terminated, whatever the peer sent
+template <typename T>
+inline void terminate_field(T&) {}
+
+template <size_t N>
+inline void terminate_field(char (&text)[N]) {
+    text[N - 1] = '\0';
+}
+
+// One field of message M, copied verbatim to and from the wire
+template <typename M, typename T, T M::*Member>
+struct Field {
+    static constexpr int SIZE = sizeof(T);
+
+    static void write(const M& message, char* buffer) {
+        std::memcpy(buffer, &(message.*Member), sizeof(T));
+    }
+
+    static void read(M& message, const char* buffer) {
+        std::memcpy(&(message.*Member), buffer, sizeof(T));
+        terminate_field(message.*Member);
+    }
+};
+
+#define MESSAGE_FIELD(Message, member) \
+    Field<Message, decltype(Message::member), &Message::member>
+
+// Ordered list of fields; each field starts where the previous one ended
+template <typename... Fields>
+struct FieldList;
+
+template <>
+struct FieldList<> {
+    static constexpr int SIZE = 0;
+
+    template <typename M>
+    static void write(const M&, char*) {}
+
+    template <typename M>
+    static void read(M&, const char*) {}
+};
+
+template <typename First, typename... Rest>
+struct FieldList<First, Rest...> {
+    static constexpr int SIZE = First::SIZE + FieldList<Rest...>::SIZE;
+
+    template <typename M>
+    static void write(const M& message, char* buffer) {
+        First::write(message, buffer);
+        FieldList<Rest...>::write(message, buffer + First::SIZE);
+    }
+
+    template <typename M>
+    static void read(M& message, const char* buffer) {
+        First::read(message, buffer);
+        FieldList<Rest...>::read(message, buffer + First::SIZE);
+    }
+};
+
+// Codec for a message made only of fixed-size fields
+template <typename M>
+struct FixedCodec {
+    static constexpr int SIZE = M::Fields::SIZE;
+
+    static int size(const M&) { return SIZE; }
+
+    static void serialize(const M& message, char* buffer) {
+        M::Fields::write(message, buffer);
+    }
+
+    // Returns false if the payload has the wrong size
+    static bool deserialize(M& message, const char* buffer, int size) {
+        if (size != SIZE) {
+            return false;
+        }
+        M::Fields::read(message, buffer);
+        return true;
+    }
+};
+
+// Compile-time list of integers, used to build dispatch tables
+template <int... Values>
+struct IntSequence {};
+
+template <int First, int Last, int... Values>
+struct MakeIntSequence : MakeIntSequence<First, Last - 1, Last - 1, Values...> {};
+
+template <int First, int... Values>
+struct MakeIntSequence<First, First, Values...> : IntSequence<Values...> {};
+
+#endif // MESSAGE_CODEC_H
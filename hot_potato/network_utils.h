@@ -2,18 +2,29 @@
 #define NETWORK_UTILS_H
 
 #include <iostream>
+#include <cstddef>
 #include <cstring>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <poll.h>
+#include <chrono>
+#include <deque>
 
 #include "potato.h"
+#include "resolver.h"
 
 // Exception class for network operations
 class NetworkError : public std::runtime_error {
@@ -26,76 +37,25 @@ class NetworkUtils {
 public:
     // Create a server socket that listens for connections
     static int create_server_socket(int port) {
-        int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_fd < 0) {
-            throw NetworkError("Failed to create socket");
-        }
-        
-        // Allow reuse of address
-        int opt = 1;
-        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-            close(server_fd);
-            throw NetworkError("Failed to set socket options");
-        }
-        
-        // Bind to port
-        struct sockaddr_in address;
-        address.sin_family = AF_INET;
-        address.sin_addr.s_addr = INADDR_ANY;
-        address.sin_port = htons(port);
-        
-        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-            close(server_fd);
-            throw NetworkError("Failed to bind to port " + std::to_string(port));
-        }
-        
-        // Listen for connections
-        if (listen(server_fd, 10) < 0) {
-            close(server_fd);
-            throw NetworkError("Failed to listen on socket");
-        }
-        
-        return server_fd;
+        return open_server_socket(port);
     }
     
     // Create a server socket with automatic port assignment
     static int create_server_socket(int* assigned_port) {
-        int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_fd < 0) {
-            throw NetworkError("Failed to create socket");
-        }
-        
-        // Allow reuse of address
-        int opt = 1;
-        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-            close(server_fd);
-            throw NetworkError("Failed to set socket options");
-        }
-        
-        // Bind to port 0 (let OS assign port)
-        struct sockaddr_in address;
-        address.sin_family = AF_INET;
-        address.sin_addr.s_addr = INADDR_ANY;
-        address.sin_port = htons(0);
-        
-        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-            close(server_fd);
-            throw NetworkError("Failed to bind to automatic port");
-        }
+        int server_fd = open_server_socket(0);
         
         // Get assigned port
+        struct sockaddr_storage address;
         socklen_t len = sizeof(address);
         if (getsockname(server_fd, (struct sockaddr*)&address, &len) < 0) {
             close(server_fd);
             throw NetworkError("Failed to get socket name");
         }
         
-        *assigned_port = ntohs(address.sin_port);
-        
-        // Listen for connections
-        if (listen(server_fd, 10) < 0) {
-            close(server_fd);
-            throw NetworkError("Failed to listen on socket");
+        if (address.ss_family == AF_INET6) {
+            *assigned_port = ntohs(((struct sockaddr_in6*)&address)->sin6_port);
+        } else {
+            *assigned_port = ntohs(((struct sockaddr_in*)&address)->sin_port);
         }
         
         return server_fd;
@@ -103,95 +63,317 @@ public:
     
     // Accept a connection on a server socket
     static int accept_connection(int server_fd, std::string* client_ip = nullptr) {
-        struct sockaddr_in client_addr;
+        struct sockaddr_storage client_addr;
         socklen_t addr_len = sizeof(client_addr);
         
         int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &addr_len);
         if (client_fd < 0) {
             throw NetworkError("Failed to accept connection");
         }
+        if (client_addr.ss_family == AF_UNIX) {
+            mark_packet_socket(client_fd, true);
+        } else {
+            mark_packet_socket(client_fd, false);
+            set_no_delay(client_fd);
+        }
         
         if (client_ip != nullptr) {
-            *client_ip = inet_ntoa(client_addr.sin_addr);
+            *client_ip = Resolver::format_address(client_addr);
         }
         
         return client_fd;
     }
     
-    // Connect to a server
+    // Addresses (IPv4 or IPv6) of a server, through the resolver cache
+    static std::vector<ResolvedAddress> resolve(const std::string& hostname, int port) {
+        try {
+            return Resolver::instance().resolve(hostname, port);
+        } catch (const ResolverError& e) {
+            throw NetworkError(e.what());
+        }
+    }
+    
+    // Connect to a server, trying each of its addresses (IPv4 or IPv6) in turn
     static int connect_to_server(const std::string& hostname, int port) {
-        struct hostent* server = gethostbyname(hostname.c_str());
-        if (server == nullptr) {
-            throw NetworkError("Failed to resolve hostname " + hostname);
+        std::vector<ResolvedAddress> addresses = resolve(hostname, port);
+        
+        for (size_t i = 0; i < addresses.size(); i++) {
+            int client_fd = socket(addresses[i].family, SOCK_STREAM, 0);
+            if (client_fd < 0) {
+                continue;
+            }
+            
+            if (connect(client_fd, (struct sockaddr*)&addresses[i].addr, addresses[i].length) == 0) {
+                mark_packet_socket(client_fd, false);
+                set_no_delay(client_fd);
+                return client_fd;
+            }
+            close(client_fd);
         }
         
-        int client_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (client_fd < 0) {
-            throw NetworkError("Failed to create socket");
+        throw NetworkError("Failed to connect to " + hostname + ":" + std::to_string(port));
+    }
+    
+    // Start a TCP connect to addresses[*next], or the first address after it
+    // that takes one, without waiting for it to complete. Advances *next past
+    // the address used. Returns the socket, which polls writable once the
+    // connect is settled, or -1 when no address is left to try.
+    static int start_connect(const std::vector<ResolvedAddress>& addresses, size_t* next) {
+        while (*next < addresses.size()) {
+            const ResolvedAddress& address = addresses[(*next)++];
+            int client_fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (client_fd < 0) {
+                continue;
+            }
+            if (connect(client_fd, (struct sockaddr*)&address.addr, address.length) == 0 ||
+                errno == EINPROGRESS) {
+                return client_fd;
+            }
+            close(client_fd);
+        }
+        return -1;
+    }
+    
+    // Whether a connect from start_connect succeeded, once the socket polls
+    // writable; if so, sets the socket up as connect_to_server does
+    static bool finish_connect(int client_fd) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(client_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            return false;
+        }
+        mark_packet_socket(client_fd, false);
+        set_no_delay(client_fd);
+        return true;
+    }
+    
+    // Name of the AF_UNIX socket a player listening on TCP port `port` also
+    // accepts neighbors on. TCP ports are unique per host, so the names are too.
+    static std::string unix_socket_name(int port) {
+        return "hot_potato." + std::to_string(port);
+    }
+    
+    // Create a SOCK_SEQPACKET server socket in the abstract AF_UNIX namespace.
+    // Abstract names need no file on disk and vanish with the socket.
+    static int create_unix_server_socket(const std::string& name) {
+        int server_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (server_fd < 0) {
+            throw NetworkError("Failed to create unix socket");
         }
         
-        struct sockaddr_in server_addr;
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(port);
-        memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+        struct sockaddr_un address;
+        socklen_t len = unix_address(name, &address);
+        if (bind(server_fd, (struct sockaddr*)&address, len) < 0) {
+            close(server_fd);
+            throw NetworkError("Failed to bind unix socket " + name);
+        }
         
-        if (connect(client_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            close(client_fd);
-            throw NetworkError("Failed to connect to " + hostname + ":" + std::to_string(port));
+        if (listen(server_fd, 10) < 0) {
+            close(server_fd);
+            throw NetworkError("Failed to listen on unix socket " + name);
         }
         
-        return client_fd;
+        return server_fd;
     }
     
-    // Get the hostname of the local machine
-    static std::string get_hostname() {
-        char hostname[256];
-        if (gethostname(hostname, sizeof(hostname)) < 0) {
-            throw NetworkError("Failed to get hostname");
+    // Connect to a SOCK_SEQPACKET server socket on this host
+    static int connect_unix(const std::string& name) {
+        int client_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (client_fd < 0) {
+            throw NetworkError("Failed to create unix socket");
         }
-        return std::string(hostname);
+        
+        struct sockaddr_un address;
+        socklen_t len = unix_address(name, &address);
+        if (connect(client_fd, (struct sockaddr*)&address, len) < 0) {
+            close(client_fd);
+            throw NetworkError("Failed to connect to unix socket " + name);
+        }
+        
+        mark_packet_socket(client_fd, true);
+        return client_fd;
     }
     
-    // Get the local IP address
-    static std::string get_local_ip() {
-        char hostname[256];
-        if (gethostname(hostname, sizeof(hostname)) < 0) {
-            throw NetworkError("Failed to get hostname");
+    // Like connect_unix, but never waits on a server whose accept backlog is
+    // full: returns -1 instead, and the caller tries again later. The socket
+    // returned is non-blocking.
+    static int try_connect_unix(const std::string& name) {
+        int client_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+        if (client_fd < 0) {
+            throw NetworkError("Failed to create unix socket");
         }
         
-        struct hostent* host = gethostbyname(hostname);
-        if (host == nullptr) {
-            throw NetworkError("Failed to resolve hostname");
+        struct sockaddr_un address;
+        socklen_t len = unix_address(name, &address);
+        if (connect(client_fd, (struct sockaddr*)&address, len) < 0) {
+            int error = errno;
+            close(client_fd);
+            if (error == EAGAIN) {
+                return -1;
+            }
+            throw NetworkError("Failed to connect to unix socket " + name);
         }
         
-        char* ip = inet_ntoa(*(struct in_addr*)host->h_addr);
-        return std::string(ip);
+        mark_packet_socket(client_fd, true);
+        return client_fd;
+    }
+    
+    // Name of the AF_UNIX socket the link relay on TCP port `port` serves
+    // this host's players on
+    static std::string relay_socket_name(int port) {
+        return "hot_potato.relay." + std::to_string(port);
+    }
+    
+    // Open a link to a player on another host through this host's relay.
+    // The returned socket behaves like a direct AF_UNIX link to the player;
+    // if the far side cannot be reached, the relay closes it.
+    static int connect_relay(int relay_port, const std::string& hostname, int port) {
+        int fd = connect_unix(relay_socket_name(relay_port));
+        try {
+            send<MUX_OPEN>(fd, MuxOpen::make(hostname, port));
+        } catch (const NetworkError& e) {
+            close(fd);
+            throw;
+        }
+        return fd;
     }
     
-    // Send a message with a header
-    static void send_message(int fd, MessageType type, const void* data, int size) {
+    // Encode a typed message, header included, into buffer
+    template <MessageType Type>
+    static void encode(const typename MessagePayload<Type>::type& payload, std::vector<char>& buffer) {
+        typedef MessageCodec<typename MessagePayload<Type>::type> Codec;
+        int size = Codec::size(payload);
+        buffer.resize(MessageHeader::HEADER_SIZE + size);
+        
         MessageHeader header;
-        header.type = type;
+        header.type = Type;
         header.size = size;
+        MessageHeader::Fields::write(header, buffer.data());
+        Codec::serialize(payload, buffer.data() + MessageHeader::HEADER_SIZE);
+    }
+    
+    // Send a typed message, encoded by its generated codec
+    template <MessageType Type>
+    static void send(int fd, const typename MessagePayload<Type>::type& payload) {
+        std::vector<char>& buffer = send_buffer();
+        encode<Type>(payload, buffer);
+        if (send_all(fd, buffer.data(), buffer.size()) < 0) {
+            throw NetworkError("Failed to send message");
+        }
+    }
+    
+    // Send a message that carries no payload
+    template <MessageType Type>
+    static void send(int fd) {
+        send<Type>(fd, EmptyMessage());
+    }
+    
+    // Send the same message to every fd in fds (entries < 0 are skipped)
+    // without letting one slow peer hold up the others. The message is
+    // encoded once; sends never block, and peers whose buffers are full are
+    // finished off as poll() reports them writable. Gives up on the stragglers
+    // after timeout_ms and returns how many peers got the whole message.
+    template <MessageType Type>
+    static int broadcast(const std::vector<int>& fds, const typename MessagePayload<Type>::type& payload,
+                         int timeout_ms) {
+        std::vector<char> buffer;
+        encode<Type>(payload, buffer);
+        
+        // Bytes already sent to each peer; -1 once a peer has failed
+        std::vector<int> sent(fds.size(), 0);
+        int delivered = 0;
+        std::vector<struct pollfd> pending;
+        std::vector<size_t> pending_index;
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            if (send_some(fds[i], buffer, &sent[i])) {
+                delivered++;
+            } else if (sent[i] >= 0) {
+                struct pollfd entry = {fds[i], POLLOUT, 0};
+                pending.push_back(entry);
+                pending_index.push_back(i);
+            }
+        }
         
-        char header_buf[MessageHeader::HEADER_SIZE];
-        header.serialize(header_buf);
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!pending.empty()) {
+            int wait_ms = remaining_ms(deadline);
+            if (wait_ms <= 0 || poll(pending.data(), pending.size(), wait_ms) <= 0) {
+                break;
+            }
+            for (size_t p = pending.size(); p-- > 0;) {
+                if (pending[p].revents == 0) {
+                    continue;
+                }
+                size_t i = pending_index[p];
+                bool done = send_some(fds[i], buffer, &sent[i]);
+                if (done) {
+                    delivered++;
+                }
+                if (done || sent[i] < 0) {
+                    pending.erase(pending.begin() + p);
+                    pending_index.erase(pending_index.begin() + p);
+                }
+            }
+        }
         
-        if (send_all(fd, header_buf, MessageHeader::HEADER_SIZE) < 0) {
-            throw NetworkError("Failed to send message header");
+        return delivered;
+    }
+    
+    template <MessageType Type>
+    static int broadcast(const std::vector<int>& fds, int timeout_ms) {
+        return broadcast<Type>(fds, EmptyMessage(), timeout_ms);
+    }
+    
+    // Wait for the peers of fds (entries < 0 are skipped) to close their end,
+    // discarding whatever they still send. Gives up after timeout_ms and
+    // returns how many peers closed.
+    static int wait_for_close(const std::vector<int>& fds, int timeout_ms) {
+        std::vector<struct pollfd> pending;
+        for (int fd : fds) {
+            if (fd >= 0) {
+                struct pollfd entry = {fd, POLLIN, 0};
+                pending.push_back(entry);
+            }
         }
         
-        if (size > 0 && data != nullptr) {
-            if (send_all(fd, data, size) < 0) {
-                throw NetworkError("Failed to send message data");
+        int closed = 0;
+        char discard[512];
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!pending.empty()) {
+            int wait_ms = remaining_ms(deadline);
+            if (wait_ms <= 0 || poll(pending.data(), pending.size(), wait_ms) <= 0) {
+                break;
+            }
+            for (size_t p = pending.size(); p-- > 0;) {
+                if (pending[p].revents == 0) {
+                    continue;
+                }
+                ssize_t received = recv(pending[p].fd, discard, sizeof(discard), MSG_DONTWAIT);
+                if (received > 0 || (received < 0 && (errno == EAGAIN || errno == EINTR))) {
+                    continue;
+                }
+                closed++;
+                pending.erase(pending.begin() + p);
             }
         }
+        
+        return closed;
     }
     
     // Receive a message with a header
     static MessageHeader receive_message(int socket_fd, std::vector<char>& data) {
+        if (is_packet_socket(socket_fd)) {
+            return receive_packet(socket_fd, data);
+        }
+        
         MessageHeader header;
-        ssize_t bytes_received = recv(socket_fd, &header, sizeof(header), MSG_WAITALL);
+        char header_buf[MessageHeader::HEADER_SIZE];
+        ssize_t bytes_received = recv(socket_fd, header_buf, sizeof(header_buf), MSG_WAITALL);
         
         // Check if connection closed (normal during shutdown)
         if (bytes_received == 0) {
@@ -208,13 +390,17 @@ public:
         }
         
         // Handle incomplete header - fix signed/unsigned comparison
-        if ((size_t)bytes_received < sizeof(header)) {
+        if ((size_t)bytes_received < sizeof(header_buf)) {
             throw NetworkError("Received incomplete message header");
         }
         
-        // Rest of your function to read message body...
+        MessageHeader::Fields::read(header, header_buf);
+        if (header.size < 0 || header.size > MAX_MESSAGE_SIZE) {
+            throw NetworkError("Invalid message size " + std::to_string(header.size));
+        }
+        
+        data.resize(header.size);
         if (header.size > 0) {
-            data.resize(header.size);
             ssize_t body_received = recv(socket_fd, data.data(), header.size, MSG_WAITALL);
             
             // Fix another potential signed/unsigned comparison
@@ -232,106 +418,220 @@ public:
         return header;
     }
     
-    // Send a potato
-    static void send_potato(int fd, const Potato& potato) {
-        int size = potato.get_serialized_size();
-        std::vector<char> buffer(size);
-        potato.serialize(buffer.data());
-        
-        send_message(fd, POTATO_TRANSFER, buffer.data(), size);
-    }
-    
-    // Receive a potato
-    static Potato receive_potato(int fd) {
+    // Receive a message that must be of the given type
+    template <MessageType Type>
+    static typename MessagePayload<Type>::type receive(int fd) {
         std::vector<char> data;
         MessageHeader header = receive_message(fd, data);
         
-        // Handle both potato transfers and game over messages
-        if (header.type == GAME_OVER) {
-            // Game is over, return an empty potato with 0 hops
-            // This will signal the end of the game
-            return Potato(0);
-        } else if (header.type != POTATO_TRANSFER) {
-            throw NetworkError("Expected POTATO_TRANSFER message, got " + std::to_string(header.type));
+        if (header.type != Type) {
+            throw NetworkError("Expected message type " + std::to_string(Type) +
+                               ", got " + std::to_string(header.type));
         }
         
-        Potato potato;
-        potato.deserialize(data.data());
-        return potato;
+        typename MessagePayload<Type>::type payload;
+        if (!MessageCodec<typename MessagePayload<Type>::type>::deserialize(payload, data.data(), header.size)) {
+            throw NetworkError("Malformed message of type " + std::to_string(Type));
+        }
+        return payload;
     }
     
-    // Send setup info
-    static void send_setup_info(int fd, int player_id, int total_players) {
-        SetupInfo info;
-        info.player_id = player_id;
-        info.total_players = total_players;
-        
-        char buffer[SetupInfo::SIZE];
-        info.serialize(buffer);
-        
-        send_message(fd, SETUP_INFO, buffer, SetupInfo::SIZE);
+    // Bytes received on a socket but not yet read. Packet sockets report
+    // only the next packet. Returns 0 if the socket cannot be queried.
+    static int queued_input(int fd) {
+        int bytes = 0;
+        if (fd < 0 || ioctl(fd, SIOCINQ, &bytes) < 0) {
+            return 0;
+        }
+        return bytes;
     }
     
-    // Receive setup info
-    static SetupInfo receive_setup_info(int fd) {
-        std::vector<char> data;
-        MessageHeader header = receive_message(fd, data);
-        
-        if (header.type != SETUP_INFO) {
-            throw NetworkError("Expected SETUP_INFO message, got " + std::to_string(header.type));
+    // Bytes written to a socket that the peer has not taken yet (for TCP,
+    // not yet acknowledged). Returns 0 if the socket cannot be queried.
+    static int queued_output(int fd) {
+        int bytes = 0;
+        if (fd < 0 || ioctl(fd, SIOCOUTQ, &bytes) < 0) {
+            return 0;
         }
-        
-        SetupInfo info;
-        info.deserialize(data.data());
-        return info;
+        return bytes;
+    }
+    
+    // Push as much of buffer as fd accepts right now, starting at *sent.
+    // Returns true once all of it is out; *sent becomes -1 if the peer failed.
+    // A SOCK_SEQPACKET socket takes the whole buffer or nothing.
+    static bool send_some(int fd, const std::vector<char>& buffer, int* sent) {
+        while (*sent < static_cast<int>(buffer.size())) {
+            ssize_t result = ::send(fd, buffer.data() + *sent, buffer.size() - *sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return false;
+            }
+            if (result <= 0) {
+                *sent = -1;
+                return false;
+            }
+            *sent += result;
+        }
+        return true;
     }
     
-    // Send neighbor info
-    static void send_neighbor_info(int fd, int left_id, int right_id, 
-                                  const std::string& left_ip, const std::string& right_ip,
-                                  int left_port, int right_port) {
-        NeighborInfo info;
-        info.left_id = left_id;
-        info.right_id = right_id;
-        info.left_port = left_port;
-        info.right_port = right_port;
+private:
+    // Bind and listen on port (0 = any). The socket is dual-stack IPv6 so
+    // players can reach it over either protocol; hosts without IPv6 get a
+    // plain IPv4 socket instead.
+    static int open_server_socket(int port) {
+        int family = AF_INET6;
+        int server_fd = socket(AF_INET6, SOCK_STREAM, 0);
+        if (server_fd < 0) {
+            family = AF_INET;
+            server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        }
+        if (server_fd < 0) {
+            throw NetworkError("Failed to create socket");
+        }
         
-        strncpy(info.left_ip, left_ip.c_str(), 64);
-        strncpy(info.right_ip, right_ip.c_str(), 64);
+        // Allow reuse of address
+        int opt = 1;
+        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            close(server_fd);
+            throw NetworkError("Failed to set socket options");
+        }
         
-        char buffer[NeighborInfo::SIZE];
-        info.serialize(buffer);
+        int bound;
+        if (family == AF_INET6) {
+            // Accept IPv4 clients too, as IPv4-mapped addresses
+            int v6only = 0;
+            setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+            
+            struct sockaddr_in6 address;
+            memset(&address, 0, sizeof(address));
+            address.sin6_family = AF_INET6;
+            address.sin6_addr = in6addr_any;
+            address.sin6_port = htons(port);
+            bound = bind(server_fd, (struct sockaddr*)&address, sizeof(address));
+        } else {
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = INADDR_ANY;
+            address.sin_port = htons(port);
+            bound = bind(server_fd, (struct sockaddr*)&address, sizeof(address));
+        }
         
-        send_message(fd, NEIGHBOR_INFO, buffer, NeighborInfo::SIZE);
+        if (bound < 0) {
+            close(server_fd);
+            if (port == 0) {
+                throw NetworkError("Failed to bind to automatic port");
+            }
+            throw NetworkError("Failed to bind to port " + std::to_string(port));
+        }
+        
+        // Listen for connections
+        if (listen(server_fd, 10) < 0) {
+            close(server_fd);
+            throw NetworkError("Failed to listen on socket");
+        }
+        
+        return server_fd;
     }
     
-    // Receive neighbor info
-    static NeighborInfo receive_neighbor_info(int fd) {
-        std::vector<char> data;
-        MessageHeader header = receive_message(fd, data);
+    // Largest payload accepted from a peer
+    static const int MAX_MESSAGE_SIZE = 1 << 24;
+    
+    // Per-thread scratch buffer reused for outgoing messages
+    static std::vector<char>& send_buffer() {
+        static thread_local std::vector<char> buffer;
+        return buffer;
+    }
+
+    // Every message is one small write that the peer answers right away, so
+    // Nagle's algorithm only ever adds a delayed-ACK wait per hop
+    static void set_no_delay(int fd) {
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+
+    // Largest message carried over a SOCK_SEQPACKET link
+    static const int MAX_PACKET_SIZE = 1 << 16;
+    
+    // Which fds are SOCK_SEQPACKET links, indexed by fd. Every socket that
+    // NetworkUtils connects or accepts sets its entry, so a reused fd number
+    // never inherits a stale one.
+    static std::vector<bool>& packet_sockets() {
+        static std::vector<bool> sockets;
+        return sockets;
+    }
+    
+    static void mark_packet_socket(int fd, bool packet) {
+        std::vector<bool>& sockets = packet_sockets();
+        if (static_cast<size_t>(fd) >= sockets.size()) {
+            sockets.resize(fd + 1, false);
+        }
+        sockets[fd] = packet;
+    }
+    
+    static bool is_packet_socket(int fd) {
+        const std::vector<bool>& sockets = packet_sockets();
+        return static_cast<size_t>(fd) < sockets.size() && sockets[fd];
+    }
+    
+    static socklen_t unix_address(const std::string& name, struct sockaddr_un* address) {
+        memset(address, 0, sizeof(*address));
+        address->sun_family = AF_UNIX;
+        // Leading NUL selects the abstract namespace
+        size_t length = std::min(name.size(), sizeof(address->sun_path) - 1);
+        memcpy(address->sun_path + 1, name.data(), length);
+        return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+    }
+    
+    // Receive one message from a SOCK_SEQPACKET link: header and payload
+    // arrive together in a single packet, so one recv gets all of it
+    static MessageHeader receive_packet(int socket_fd, std::vector<char>& data) {
+        static thread_local std::vector<char> packet(MAX_PACKET_SIZE);
+        MessageHeader header;
+        
+        ssize_t bytes_received = recv(socket_fd, packet.data(), packet.size(), MSG_TRUNC);
         
-        if (header.type != NEIGHBOR_INFO) {
-            throw NetworkError("Expected NEIGHBOR_INFO message, got " + std::to_string(header.type));
+        // Peer closed the link, same as for a stream socket
+        if (bytes_received == 0) {
+            header.type = GAME_OVER;
+            header.size = 0;
+            return header;
         }
         
-        NeighborInfo info;
-        info.deserialize(data.data());
-        return info;
+        if (bytes_received < 0) {
+            throw NetworkError("Failed to receive message");
+        }
+        
+        if (bytes_received < MessageHeader::HEADER_SIZE || bytes_received > MAX_PACKET_SIZE) {
+            throw NetworkError("Received malformed packet of " + std::to_string(bytes_received) + " bytes");
+        }
+        
+        MessageHeader::Fields::read(header, packet.data());
+        if (header.size != bytes_received - MessageHeader::HEADER_SIZE) {
+            throw NetworkError("Invalid message size " + std::to_string(header.size));
+        }
+        
+        data.assign(packet.begin() + MessageHeader::HEADER_SIZE, packet.begin() + bytes_received);
+        return header;
     }
     
-    // Send game over message
-    static void send_game_over(int fd) {
-        send_message(fd, GAME_OVER, nullptr, 0);
+    // Milliseconds left until deadline, rounded up
+    static int remaining_ms(std::chrono::steady_clock::time_point deadline) {
+        std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+        return static_cast<int>((std::chrono::duration_cast<std::chrono::microseconds>(left).count() + 999) / 1000);
     }
     
-private:
     // Send all data
     static int send_all(int fd, const void* data, int size) {
         const char* ptr = static_cast<const char*>(data);
         int remaining = size;
         
         while (remaining > 0) {
-            int sent = send(fd, ptr, remaining, 0);
+            // MSG_NOSIGNAL: a dead peer must surface as an error, not SIGPIPE
+            int sent = ::send(fd, ptr, remaining, MSG_NOSIGNAL);
             if (sent <= 0) {
                 return -1;
             }
@@ -342,24 +642,47 @@ private:
         
         return size;
     }
+};
+
+// Messages waiting for a socket that would not take them yet. Each message
+// is encoded when queued; the first one may be partly sent. Lets a player
+// keep reading while a neighbor is slow to drain its link, instead of two
+// neighbors blocking in send towards each other.
+class SendQueue {
+private:
+    std::deque<std::vector<char> > messages;
+    int sent;  // Bytes of the first message already sent
     
-    // Receive all data
-    static int recv_all(int fd, void* data, int size) {
-        char* ptr = static_cast<char*>(data);
-        int remaining = size;
-        
-        while (remaining > 0) {
-            int received = recv(fd, ptr, remaining, 0);
-            if (received <= 0) {
-                return -1;
+public:
+    SendQueue() : sent(0) {}
+    
+    template <MessageType Type>
+    void push(const typename MessagePayload<Type>::type& payload) {
+        messages.push_back(std::vector<char>());
+        NetworkUtils::encode<Type>(payload, messages.back());
+    }
+    
+    // Send queued messages until fd would block. Returns false if the peer
+    // failed; what is left in the queue is then undeliverable.
+    bool flush(int fd) {
+        while (!messages.empty()) {
+            if (!NetworkUtils::send_some(fd, messages.front(), &sent)) {
+                return sent >= 0;
             }
-            
-            ptr += received;
-            remaining -= received;
+            messages.pop_front();
+            sent = 0;
         }
-        
-        return size;
+        return true;
+    }
+    
+    void clear() {
+        messages.clear();
+        sent = 0;
     }
+    
+    bool empty() const { return messages.empty(); }
+    
+    int size() const { return static_cast<int>(messages.size()); }
 };
 
-#endif // NETWORK_UTILS_H
\ No newline at end of file
+#endif // NETWORK_UTILS_H
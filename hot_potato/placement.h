@@ -0,0 +1,264 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// Exception class for bad CPU lists and failed placement calls
+class PlacementError : public std::runtime_error {
+public:
+    PlacementError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Where a process was placed; -1 means it was left to the scheduler
+struct PlacementInfo {
+    int cpu;
+    int numa_node;
+
+    PlacementInfo() : cpu(-1), numa_node(-1) {}
+};
+
+// CPU and NUMA placement from --cpus / --numa-node.
+// The usable CPUs are ordered by package and core, so consecutive slots are
+// hyperthread siblings first, then neighboring cores of the same socket.
+// Players take slot (id % CPUs), which puts neighboring ring positions on
+// nearby cores.
+class CpuPlacement {
+private:
+    std::vector<int> cpus;  // Usable CPUs in topology order; empty = placement off
+    int numa_node;          // Node memory is taken from (-1 = kernel default)
+
+    static int read_int(const std::string& path) {
+        std::ifstream file(path.c_str());
+        int value = -1;
+        if (!(file >> value)) {
+            return -1;
+        }
+        return value;
+    }
+
+    // CPUs of a NUMA node, from sysfs
+    static std::vector<int> node_cpus(int node) {
+        std::ifstream file(("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist").c_str());
+        std::string list;
+        if (!std::getline(file, list)) {
+            throw PlacementError("Unknown NUMA node " + std::to_string(node));
+        }
+        return parse_cpu_list(list);
+    }
+
+    // Sort key: package, then core, then logical CPU number
+    static void order_by_topology(std::vector<int>& list) {
+        std::vector<std::pair<std::pair<int, int>, int> > keyed;
+        for (int cpu : list) {
+            std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+            keyed.push_back(std::make_pair(std::make_pair(read_int(topology + "physical_package_id"),
+                                                          read_int(topology + "core_id")), cpu));
+        }
+        std::sort(keyed.begin(), keyed.end());
+        for (size_t i = 0; i < keyed.size(); i++) {
+            list[i] = keyed[i].second;
+        }
+    }
+
+    // Pin every thread of this process, not only the caller: threads started
+    // before placement (the logger's flusher, for one) would otherwise roam
+    static void pin_threads(const std::vector<int>& set) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (int cpu : set) {
+            CPU_SET(cpu, &mask);
+        }
+        if (sched_setaffinity(0, sizeof(mask), &mask) < 0) {
+            throw PlacementError("Failed to set CPU affinity");
+        }
+
+        DIR* tasks = opendir("/proc/self/task");
+        if (tasks == nullptr) {
+            return;
+        }
+        while (struct dirent* entry = readdir(tasks)) {
+            pid_t tid = static_cast<pid_t>(std::atoi(entry->d_name));
+            if (tid > 0) {
+                sched_setaffinity(tid, sizeof(mask), &mask);
+            }
+        }
+        closedir(tasks);
+    }
+
+    // Prefer node for this process's future allocations; pages already
+    // touched stay where they are
+    static void prefer_node(int node) {
+        const unsigned long bits = 8 * sizeof(unsigned long);
+        unsigned long mask[MAX_NUMA_NODES / bits] = {0};
+        if (node < 0 || node >= MAX_NUMA_NODES) {
+            throw PlacementError("NUMA node out of range: " + std::to_string(node));
+        }
+        mask[node / bits] |= 1UL << (node % bits);
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAX_NUMA_NODES) < 0) {
+            throw PlacementError("Failed to set memory policy for NUMA node " + std::to_string(node));
+        }
+    }
+
+public:
+    static const int MAX_NUMA_NODES = 1024;  // Nodes the memory policy mask can name
+
+    CpuPlacement() : numa_node(-1) {}
+
+    // Either argument may be empty / -1. A node alone means all its CPUs;
+    // with both, the listed CPUs outside the node are dropped.
+    CpuPlacement(const std::string& cpu_list, int node) : numa_node(node) {
+        if (!cpu_list.empty()) {
+            cpus = parse_cpu_list(cpu_list);
+        }
+        if (node >= 0) {
+            std::vector<int> local = node_cpus(node);
+            if (cpus.empty()) {
+                cpus = local;
+            } else {
+                std::vector<int> kept;
+                for (int cpu : cpus) {
+                    if (std::find(local.begin(), local.end(), cpu) != local.end()) {
+                        kept.push_back(cpu);
+                    }
+                }
+                if (kept.empty()) {
+                    throw PlacementError("None of the CPUs " + cpu_list + " are on NUMA node " + std::to_string(node));
+                }
+                cpus = kept;
+            }
+        }
+
+        // Fail now rather than after the game has started
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int cpu : cpus) {
+                if (!CPU_ISSET(cpu, &allowed)) {
+                    throw PlacementError("CPU " + std::to_string(cpu) + " is not available to this process");
+                }
+            }
+        }
+        order_by_topology(cpus);
+    }
+
+    bool enabled() const { return !cpus.empty(); }
+
+    // Parse a CPU list such as "0-3,8,10-11"
+    static std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> result;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t comma = list.find(',', pos);
+            std::string item = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            pos = comma == std::string::npos ? list.size() : comma + 1;
+
+            // Each number must be all digits and fill its side of the dash
+            size_t dash = item.find('-');
+            const char* start = item.c_str();
+            char* end = nullptr;
+            long first = std::strtol(start, &end, 10);
+            long last = first;
+            bool parsed = std::isdigit(static_cast<unsigned char>(*start)) && (dash == std::string::npos || end == start + dash);
+            if (parsed && dash != std::string::npos) {
+                start = item.c_str() + dash + 1;
+                last = std::strtol(start, &end, 10);
+                parsed = std::isdigit(static_cast<unsigned char>(*start));
+            }
+            if (!parsed || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+                throw PlacementError("Bad CPU list: " + list);
+            }
+            for (long cpu = first; cpu <= last; cpu++) {
+                if (std::find(result.begin(), result.end(), cpu) == result.end()) {
+                    result.push_back(static_cast<int>(cpu));
+                }
+            }
+        }
+        if (result.empty()) {
+            throw PlacementError("Bad CPU list: " + list);
+        }
+        return result;
+    }
+
+    // Parse a NUMA node number; false unless the whole text is one in range
+    static bool parse_numa_node(const char* text, int* node) {
+        char* end = nullptr;
+        long value = std::strtol(text, &end, 10);
+        if (!std::isdigit(static_cast<unsigned char>(*text)) || *end != '\0' || value >= MAX_NUMA_NODES) {
+            return false;
+        }
+        *node = static_cast<int>(value);
+        return true;
+    }
+
+    // NUMA node a CPU belongs to, -1 if unknown
+    static int node_of(int cpu) {
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            return -1;
+        }
+        int node = -1;
+        while (struct dirent* entry = readdir(dir)) {
+            std::string name(entry->d_name);
+            if (name.compare(0, 4, "node") == 0 && name.size() > 4) {
+                node = std::atoi(name.c_str() + 4);
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+
+    // Pin this process to the CPU for a slot (a player's ID) and take its
+    // memory from that CPU's node
+    PlacementInfo place_slot(int slot) const {
+        PlacementInfo info;
+        if (!enabled()) {
+            return info;
+        }
+        info.cpu = cpus[slot % cpus.size()];
+        info.numa_node = numa_node >= 0 ? numa_node : node_of(info.cpu);
+        pin_threads(std::vector<int>(1, info.cpu));
+        if (info.numa_node >= 0) {
+            prefer_node(info.numa_node);
+        }
+        return info;
+    }
+
+    // Confine this process to all the usable CPUs; used by the ringmaster,
+    // which is given its own CPUs rather than a slot among the players'
+    PlacementInfo place_all() const {
+        PlacementInfo info;
+        if (!enabled()) {
+            return info;
+        }
+        pin_threads(cpus);
+        info.cpu = cpus.size() == 1 ? cpus[0] : -1;
+        info.numa_node = numa_node;
+        if (numa_node >= 0) {
+            prefer_node(numa_node);
+        }
+        return info;
+    }
+
+    // Human-readable form of the usable CPUs in slot order
+    std::string describe() const {
+        std::string text;
+        for (size_t i = 0; i < cpus.size(); i++) {
+            text += (i > 0 ? "," : "") + std::to_string(cpus[i]);
+        }
+        return text;
+    }
+};
+
+#endif // PLACEMENT_H
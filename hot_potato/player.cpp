@@ -11,10 +11,18 @@
 #include <netdb.h>
 #include <sys/select.h>
 #include <random>
+#include <memory>
+#include <chrono>
 #include <time.h>
 
 #include "potato.h"
 #include "network_utils.h"
+#include "datagram_link.h"
+#include "logger.h"
+#include "forwarding_policy.h"
+#include "potato_hop.h"
+#include "placement.h"
+#include "probes.h"
 
 class Player {
 private:
@@ -23,14 +31,31 @@ private:
     int master_fd;         // Socket to ringmaster
     int left_fd;           // Socket to left neighbor
     int right_fd;          // Socket to right neighbor
+    SendQueue left_queue;  // Potatoes the left link has not taken yet
+    SendQueue right_queue; // ... and the right link
     int listen_fd;         // Listening socket for neighbor connections
+    int left_listen_fd;    // Which listener the left neighbor connects to (-1 = none, UDP)
     int listen_port;       // Port on which player is listening
+    int unix_listen_fd;    // AF_UNIX listening socket for co-located neighbors (-1 = none)
+    int relay_port;        // Port of the link relays, for links through them
+    DatagramLink datagram; // Both neighbor links in UDP mode; left_fd/right_fd stay -1
     int left_id;           // ID of left neighbor
     int right_id;          // ID of right neighbor
+    int heartbeat_ms;      // Heartbeat period to the ringmaster (0 = off)
+    int checkpoint_interval; // Checkpoint the potato every N hops (0 = off)
+    int epoch;             // Newest ring epoch seen; older potatoes are stale
+    std::unique_ptr<ForwardingPolicy> policy; // Picks the neighbor each potato goes to
+    NeighborLoad left_load;  // What the policy knows about the left neighbor
+    NeighborLoad right_load; // ... and about the right one
+    long forwarded;        // Potatoes passed to a neighbor so far
+    std::chrono::steady_clock::time_point last_master_send;
     std::mt19937 rng;      // Random number generator
 
 public:
-    Player(const std::string& master_hostname, int master_port) {
+    Player(const std::string& master_hostname, int master_port, double udp_loss = 0,
+           const CpuPlacement& placement = CpuPlacement())
+        : master_fd(-1), left_fd(-1), right_fd(-1), left_listen_fd(-1), unix_listen_fd(-1), relay_port(0),
+          epoch(0), forwarded(0) {
         // Initialize random number generator
         std::random_device rd;
         rng.seed(rd());
@@ -48,22 +73,57 @@ public:
             master_fd = NetworkUtils::connect_to_server(master_hostname, master_port);
             
             // Receive player ID and total number of players
-            SetupInfo setup = NetworkUtils::receive_setup_info(master_fd);
+            SetupInfo setup = NetworkUtils::receive<SETUP_INFO>(master_fd);
             id = setup.player_id;
             num_players = setup.total_players;
+            heartbeat_ms = setup.heartbeat_ms;
+            checkpoint_interval = setup.checkpoint_interval;
+            relay_port = setup.relay_port;
+            policy = ForwardingPolicy::create(setup.forwarding_policy);
             
             // Seed RNG with player ID to make each player's randomness different
             rng.seed(rd() + id);
             
+            // Move to this player's CPU before the game buffers are allocated
+            PlacementInfo placed;
+            try {
+                placed = placement.place_slot(id);
+            } catch (const PlacementError& e) {
+                std::cerr << e.what() << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            
+            // Neighbors on this host, and the link relay, may connect over
+            // AF_UNIX; listen before reporting ready so the socket exists when they do
+            if (setup.transport == TRANSPORT_UNIX || setup.transport == TRANSPORT_AUTO ||
+                setup.transport == TRANSPORT_MUX) {
+                unix_listen_fd = NetworkUtils::create_unix_server_socket(
+                    NetworkUtils::unix_socket_name(listen_port));
+            }
+            
+            // In UDP mode neighbors reach this player on its datagram port
+            if (setup.transport == TRANSPORT_UDP) {
+                datagram.open();
+                datagram.set_loss_rate(udp_loss);
+            }
+            
             // Send listening port to ringmaster
-            NetworkUtils::send_message(master_fd, NEIGHBOR_INFO, &listen_port, sizeof(listen_port));
+            PlayerReady ready;
+            ready.listen_port = datagram.is_open() ? datagram.get_port() : listen_port;
+            ready.cpu = placed.cpu;
+            ready.numa_node = placed.numa_node;
+            NetworkUtils::send<PLAYER_READY>(master_fd, ready);
             
             std::cout << "Connected as player " << id << " out of " << num_players << " total players" << std::endl;
+            if (placed.cpu >= 0) {
+                std::cout << "Pinned to CPU " << placed.cpu << ", NUMA node " << placed.numa_node << std::endl;
+            }
             
             // Receive neighbor information
-            NeighborInfo neighbors = NetworkUtils::receive_neighbor_info(master_fd);
+            NeighborInfo neighbors = NetworkUtils::receive<NEIGHBOR_INFO>(master_fd);
             left_id = neighbors.left_id;
             right_id = neighbors.right_id;
+            prefetch_neighbors(neighbors);
             
             // Setup connections with neighbors
             setup_neighbors(neighbors);
@@ -75,13 +135,49 @@ public:
     }
     
     ~Player() {
-        close(master_fd);
-        close(left_fd);
-        close(right_fd);
+        close_connections();
         close(listen_fd);
+        if (unix_listen_fd >= 0) {
+            close(unix_listen_fd);
+        }
+    }
+    
+    // Resolve both neighbor addresses concurrently, so the links below (and
+    // any later ring repair towards them) connect without a lookup each
+    void prefetch_neighbors(const NeighborInfo& neighbors) {
+        std::vector<std::string> hosts;
+        hosts.push_back(neighbors.left_ip);
+        hosts.push_back(neighbors.right_ip);
+        Resolver::instance().prefetch(hosts);
+    }
+    
+    // Open the link to the right neighbor over the transport the ringmaster chose
+    int connect_right(const NeighborInfo& neighbors) {
+        if (neighbors.right_transport == TRANSPORT_UNIX) {
+            return NetworkUtils::connect_unix(NetworkUtils::unix_socket_name(neighbors.right_port));
+        }
+        if (neighbors.right_transport == TRANSPORT_MUX) {
+            return NetworkUtils::connect_relay(relay_port, neighbors.right_ip, neighbors.right_port);
+        }
+        return NetworkUtils::connect_to_server(neighbors.right_ip, neighbors.right_port);
+    }
+    
+    // Socket on which the left neighbor (or the relay on its behalf) will connect
+    int left_listener(const NeighborInfo& neighbors) const {
+        if ((neighbors.left_transport == TRANSPORT_UNIX || neighbors.left_transport == TRANSPORT_MUX) &&
+            unix_listen_fd >= 0) {
+            return unix_listen_fd;
+        }
+        return listen_fd;
     }
     
     void setup_neighbors(const NeighborInfo& neighbors) {
+        // Datagrams need no connection set up
+        if (datagram.is_open()) {
+            datagram.set_neighbors(neighbors);
+            return;
+        }
+        
         // This approach to establishing connections prevents deadlock
         // First, all players connect to their right neighbors
         // Then all players accept connections from their left neighbors
@@ -90,7 +186,7 @@ public:
         // (Highest ID player waits for everyone else to connect first)
         if (id != num_players - 1) {
             try {
-                right_fd = NetworkUtils::connect_to_server(neighbors.right_ip, neighbors.right_port);
+                right_fd = connect_right(neighbors);
             } catch (const NetworkError& e) {
                 std::cerr << e.what() << std::endl;
                 exit(EXIT_FAILURE);
@@ -100,7 +196,8 @@ public:
         // Accept connection from left neighbor
         try {
             std::string left_ip;
-            left_fd = NetworkUtils::accept_connection(listen_fd, &left_ip);
+            left_listen_fd = left_listener(neighbors);
+            left_fd = NetworkUtils::accept_connection(left_listen_fd, &left_ip);
         } catch (const NetworkError& e) {
             std::cerr << e.what() << std::endl;
             exit(EXIT_FAILURE);
@@ -109,7 +206,7 @@ public:
         // If this is the highest ID player, connect to right neighbor (which is player 0)
         if (id == num_players - 1) {
             try {
-                right_fd = NetworkUtils::connect_to_server(neighbors.right_ip, neighbors.right_port);
+                right_fd = connect_right(neighbors);
             } catch (const NetworkError& e) {
                 std::cerr << e.what() << std::endl;
                 exit(EXIT_FAILURE);
@@ -119,133 +216,496 @@ public:
     
     void play_game() {
         fd_set read_fds;
-        int max_fd = std::max(master_fd, std::max(left_fd, right_fd));
+        fd_set write_fds;
+        last_master_send = std::chrono::steady_clock::now();
         
         // Main game loop
         while (true) {
-            // Set up select() to monitor all sockets
+            // Set up select() to monitor all live sockets; a neighbor link is
+            // -1 while it is down and waiting for the ringmaster to repair it.
+            // Links with potatoes queued are also watched for room to send,
+            // and while the left link is down its listener is watched for
+            // the neighbor a repair sends.
             FD_ZERO(&read_fds);
+            FD_ZERO(&write_fds);
             FD_SET(master_fd, &read_fds);
-            FD_SET(left_fd, &read_fds);
-            FD_SET(right_fd, &read_fds);
+            int max_fd = master_fd;
+            if (left_fd < 0 && left_listen_fd >= 0) {
+                FD_SET(left_listen_fd, &read_fds);
+                max_fd = std::max(max_fd, left_listen_fd);
+            }
+            if (left_fd >= 0) {
+                FD_SET(left_fd, &read_fds);
+                if (!left_queue.empty()) {
+                    FD_SET(left_fd, &write_fds);
+                }
+                max_fd = std::max(max_fd, left_fd);
+            }
+            if (right_fd >= 0) {
+                FD_SET(right_fd, &read_fds);
+                if (!right_queue.empty()) {
+                    FD_SET(right_fd, &write_fds);
+                }
+                max_fd = std::max(max_fd, right_fd);
+            }
+            if (datagram.is_open()) {
+                FD_SET(datagram.get_fd(), &read_fds);
+                max_fd = std::max(max_fd, datagram.get_fd());
+            }
+            
+            // Wait for data on any socket, waking up in time for the next
+            // heartbeat or datagram timer
+            int wait_ms = -1;
+            if (heartbeat_ms > 0) {
+                wait_ms = std::max(0, heartbeat_ms - static_cast<int>(ms_since(last_master_send)));
+            }
+            if (datagram.is_open()) {
+                int retransmit_ms = datagram.next_timeout_ms();
+                if (retransmit_ms >= 0 && (wait_ms < 0 || retransmit_ms < wait_ms)) {
+                    wait_ms = retransmit_ms;
+                }
+            }
+            struct timeval timeout;
+            struct timeval* timeout_ptr = NULL;
+            if (wait_ms >= 0) {
+                timeout.tv_sec = wait_ms / 1000;
+                timeout.tv_usec = (wait_ms % 1000) * 1000;
+                timeout_ptr = &timeout;
+            }
             
-            // Wait for data on any socket
-            if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
+            POTATO_PROBE(SELECT_ENTER, -1, -1);
+            if (select(max_fd + 1, &read_fds, &write_fds, NULL, timeout_ptr) < 0) {
                 std::cerr << "Error in select" << std::endl;
                 exit(EXIT_FAILURE);
             }
+            POTATO_PROBE(SELECT_WAKEUP, -1, -1);
             
-            // Check each socket for data
+            // Check each socket for data. The ringmaster goes last: a ring
+            // repair replaces the neighbor links, and a new link may reuse an
+            // old descriptor number that select reported readable.
             try {
-                // Check sockets for data
-                if (FD_ISSET(master_fd, &read_fds)) {
-                    try {
-                        Potato potato = NetworkUtils::receive_potato(master_fd);
-                        if (potato.get_hops() == 0) {
-                            // Game over signal
-                            break;
-                        }
-                        handle_potato(potato);
-                    } catch (const NetworkError& e) {
-                        // If we get an error from the master, it's likely game over
-                        if (std::string(e.what()).find("connection reset") != std::string::npos ||
-                            std::string(e.what()).find("connection closed") != std::string::npos) {
-                            break;
-                        }
-                        throw; // Re-throw other errors
-                    }
+                if (left_fd < 0 && left_listen_fd >= 0 && FD_ISSET(left_listen_fd, &read_fds)) {
+                    accept_left();
+                }
+                
+                if (left_fd >= 0 && FD_ISSET(left_fd, &write_fds)) {
+                    flush_link(left_fd, left_queue);
+                }
+                
+                if (right_fd >= 0 && FD_ISSET(right_fd, &write_fds)) {
+                    flush_link(right_fd, right_queue);
+                }
+                
+                if (left_fd >= 0 && FD_ISSET(left_fd, &read_fds)) {
+                    handle_neighbor_message(left_fd, left_queue);
+                }
+                
+                if (right_fd >= 0 && FD_ISSET(right_fd, &read_fds)) {
+                    handle_neighbor_message(right_fd, right_queue);
                 }
                 
-                if (FD_ISSET(left_fd, &read_fds)) {
-                    try {
-                        Potato potato = NetworkUtils::receive_potato(left_fd);
-                        if (potato.get_hops() == 0) {
-                            break;  // Game over
-                        }
-                        handle_potato(potato);
-                    } catch (const NetworkError& e) {
-                        // Likely shutdown in progress
-                        break;
+                if (datagram.is_open()) {
+                    if (FD_ISSET(datagram.get_fd(), &read_fds)) {
+                        handle_datagrams();
                     }
+                    datagram.on_timer();
                 }
                 
-                if (FD_ISSET(right_fd, &read_fds)) {
-                    try {
-                        Potato potato = NetworkUtils::receive_potato(right_fd);
-                        if (potato.get_hops() == 0) {
-                            break;  // Game over
-                        }
-                        handle_potato(potato);
-                    } catch (const NetworkError& e) {
-                        // Likely shutdown in progress
-                        break;
+                if (FD_ISSET(master_fd, &read_fds)) {
+                    if (!handle_master_message()) {
+                        break;  // Game over
                     }
                 }
-            } catch (const NetworkError& e) {
-                // During shutdown, we might get errors when connections close
-                if (std::string(e.what()).find("connection reset") != std::string::npos ||
-                    std::string(e.what()).find("connection closed") != std::string::npos) {
-                    // Normal shutdown - just exit the game loop
-                    break;
-                } else {
-                    // Unexpected error during active game
-                    std::cerr << e.what() << std::endl;
-                    exit(EXIT_FAILURE);
+                
+                if (heartbeat_ms > 0 && ms_since(last_master_send) >= heartbeat_ms) {
+                    NetworkUtils::send<HEARTBEAT>(master_fd);
+                    last_master_send = std::chrono::steady_clock::now();
                 }
+            } catch (const NetworkError& e) {
+                // Losing the ringmaster means the game is over for this player
+                std::cerr << e.what() << std::endl;
+                break;
             }
         }
+        
+        close_connections();
+        if (datagram.get_retransmits() > 0 || datagram.get_duplicates() > 0) {
+            LOG_MSG(LOG_LEVEL_INFO, "Datagrams retransmitted: %ld, duplicates dropped: %ld",
+                    datagram.get_retransmits(), datagram.get_duplicates());
+        }
+    }
+    
+    // Leave the ring right away: neighbor links first, then the ringmaster
+    // connection, whose close tells the ringmaster this player is done
+    void close_connections() {
+        drop_link(left_fd, left_queue);
+        drop_link(right_fd, right_queue);
+        datagram.close_socket();
+        if (master_fd >= 0) {
+            close(master_fd);
+            master_fd = -1;
+        }
+    }
+    
+    // Handles messages arriving from the ringmaster
+    struct MasterHandler {
+        Player& player;
+        bool game_over;
+        
+        MasterHandler(Player& owner) : player(owner), game_over(false) {}
+        
+        void on_message(MessageTag<POTATO_TRANSFER>, Potato& potato) {
+            POTATO_PROBE(DECODE_DONE, potato.get_id(), potato.get_hops());
+            player.receive_potato(potato);
+        }
+        
+        void on_message(MessageTag<NEIGHBOR_INFO>, NeighborInfo& neighbors) {
+            player.repair_neighbors(neighbors);
+        }
+        
+        // Explicit game over, or the ringmaster closed the connection
+        void on_message(MessageTag<GAME_OVER>, EmptyMessage&) {
+            game_over = true;
+        }
+        
+        template <MessageType Type, typename Payload>
+        void on_message(MessageTag<Type>, Payload&) {
+            throw NetworkError("Unexpected message from ringmaster: " + std::to_string(Type));
+        }
+    };
+    
+    // Handles messages arriving from a neighbor
+    struct NeighborHandler {
+        Player& player;
+        bool link_down;
+        
+        NeighborHandler(Player& owner) : player(owner), link_down(false) {}
+        
+        void on_message(MessageTag<POTATO_TRANSFER>, Potato& potato) {
+            POTATO_PROBE(DECODE_DONE, potato.get_id(), potato.get_hops());
+            player.note_load_hint(potato);
+            player.receive_potato(potato);
+        }
+        
+        // Anything else means the neighbor closed the link or is confused
+        template <MessageType Type, typename Payload>
+        void on_message(MessageTag<Type>, Payload&) {
+            link_down = true;
+        }
+    };
+    
+    // Handle one message from the ringmaster; returns false on game over
+    bool handle_master_message() {
+        std::vector<char> data;
+        MessageHeader header = NetworkUtils::receive_message(master_fd, data);
+        POTATO_PROBE(RECEIVE_DONE, -1, -1);
+        
+        MasterHandler handler(*this);
+        if (!dispatch_message(handler, header, data)) {
+            throw NetworkError("Malformed message from ringmaster");
+        }
+        return !handler.game_over;
+    }
+    
+    // Handle one message from a neighbor; a closed or broken link is dropped
+    void handle_neighbor_message(int& fd, SendQueue& queue) {
+        std::vector<char> data;
+        NeighborHandler handler(*this);
+        try {
+            MessageHeader header = NetworkUtils::receive_message(fd, data);
+            POTATO_PROBE(RECEIVE_DONE, -1, -1);
+            if (!dispatch_message(handler, header, data)) {
+                handler.link_down = true;
+            }
+        } catch (const NetworkError& e) {
+            handler.link_down = true;
+        }
+        
+        if (handler.link_down) {
+            // The neighbor is gone; wait for game over or a ring repair
+            drop_link(fd, queue);
+        }
+    }
+    
+    // Send what a link has queued now that it has room; drop it if it failed
+    void flush_link(int& fd, SendQueue& queue) {
+        if (!queue.flush(fd)) {
+            drop_link(fd, queue);
+        }
+    }
+    
+    // Close a neighbor link. Potatoes still queued on it are lost with it,
+    // like those in a dead neighbor's socket, and come back from checkpoints.
+    void drop_link(int& fd, SendQueue& queue) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        queue.clear();
+    }
+    
+    // Handle every message waiting on the datagram socket. There is no
+    // connection to lose, so anything unexpected is simply ignored.
+    void handle_datagrams() {
+        std::vector<DatagramLink::Delivery> deliveries = datagram.receive();
+        POTATO_PROBE(RECEIVE_DONE, -1, -1);
+        for (DatagramLink::Delivery& delivery : deliveries) {
+            NeighborHandler handler(*this);
+            dispatch_message(handler, delivery.header, delivery.data);
+        }
+    }
+    
+    // Take the connection of a new left neighbor. A link that turns out to
+    // be stale, from a neighbor that died before the latest repair, closes
+    // at once and the player goes back to waiting for the next one.
+    void accept_left() {
+        try {
+            left_fd = NetworkUtils::accept_connection(left_listen_fd);
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    
+    // Apply new neighbor information sent by the ringmaster after a player died.
+    // The right link is connected here; the new left neighbor's connection is
+    // taken from the play_game loop whenever it arrives, so a slow or failed
+    // neighbor never stalls this player.
+    void repair_neighbors(const NeighborInfo& neighbors) {
+        prefetch_neighbors(neighbors);
+        if (neighbors.left_id != left_id) {
+            left_load = NeighborLoad();
+        }
+        if (neighbors.right_id != right_id) {
+            right_load = NeighborLoad();
+        }
+        if (datagram.is_open()) {
+            left_id = neighbors.left_id;
+            right_id = neighbors.right_id;
+            datagram.set_neighbors(neighbors);
+            return;
+        }
+        
+        if (neighbors.right_id != right_id || right_fd < 0) {
+            drop_link(right_fd, right_queue);
+            right_id = neighbors.right_id;
+            try {
+                right_fd = connect_right(neighbors);
+            } catch (const NetworkError& e) {
+                std::cerr << e.what() << std::endl;
+                right_fd = -1;
+            }
+        }
+        
+        if (neighbors.left_id != left_id) {
+            drop_link(left_fd, left_queue);
+            left_id = neighbors.left_id;
+        }
+        left_listen_fd = left_listener(neighbors);
+    }
+    
+    // Accept an incoming potato unless it belongs to an epoch that has since
+    // been superseded by a recovered copy
+    void receive_potato(Potato& potato) {
+        if (potato.get_epoch() < epoch) {
+            return;
+        }
+        epoch = potato.get_epoch();
+        if (potato.get_hops() > 0) {
+            handle_potato(potato);
+        }
     }
     
     void handle_potato(Potato& potato) {
-        // Decrement hop count
-        potato.decrement_hop();
+        POTATO_PROBE(HANDLE_START, potato.get_id(), potato.get_hops());
         
-        // Add this player to the trace
-        potato.add_to_trace(id);
+        // Count the hop and let the policy pick a neighbor
+        PotatoHop hop = PotatoHop::take(potato, id, checkpoint_interval, *policy, left_load, right_load, rng,
+                                        [this](Potato& passed) { measure_load(passed); });
         
         // Check if the potato is done
-        if (potato.get_hops() == 0) {
-            std::cout << "I'm it" << std::endl;
+        if (hop.finished) {
+            LOG_MSG(LOG_LEVEL_INFO, "I'm it");
             
             // Send potato back to ringmaster
             try {
-                NetworkUtils::send_potato(master_fd, potato);
+                POTATO_PROBE(SEND_START, potato.get_id(), potato.get_hops());
+                NetworkUtils::send<POTATO_TRANSFER>(master_fd, potato);
+                POTATO_PROBE(SEND_DONE, potato.get_id(), potato.get_hops());
+                last_master_send = std::chrono::steady_clock::now();
             } catch (const NetworkError& e) {
                 std::cerr << e.what() << std::endl;
                 exit(EXIT_FAILURE);
             }
+            return;
+        }
+        
+        // Periodically leave a copy with the ringmaster so the potato can be
+        // recovered if it is lost with a dead player
+        if (hop.checkpoint) {
+            send_to_master<CHECKPOINT>(potato);
+        }
+        
+        // Pass potato to the neighbor the policy picked, falling back to the
+        // other side if that link is down, and to the ringmaster, which
+        // passes it on elsewhere, if both are
+        if (hop.side == DIRECTION_LEFT) {
+            if (!send_to_neighbor(left_fd, left_queue, left_id, left_load, potato) &&
+                !send_to_neighbor(right_fd, right_queue, right_id, right_load, potato)) {
+                send_to_master<ORPHANED_POTATO>(potato);
+            }
         } else {
-            // Randomly choose left or right neighbor
-            std::uniform_int_distribution<int> dist(0, 1);
-            int random_choice = dist(rng);
-            
-            // Pass potato to chosen neighbor
-            try {
-                if (random_choice == 0) {
-                    std::cout << "Sending potato to " << left_id << std::endl;
-                    NetworkUtils::send_potato(left_fd, potato);
-                } else {
-                    std::cout << "Sending potato to " << right_id << std::endl;
-                    NetworkUtils::send_potato(right_fd, potato);
-                }
-            } catch (const NetworkError& e) {
-                std::cerr << e.what() << std::endl;
-                exit(EXIT_FAILURE);
+            if (!send_to_neighbor(right_fd, right_queue, right_id, right_load, potato) &&
+                !send_to_neighbor(left_fd, left_queue, left_id, left_load, potato)) {
+                send_to_master<ORPHANED_POTATO>(potato);
             }
         }
     }
+    
+    // Remember the backlog a neighbor reported on the potato it just sent us
+    void note_load_hint(const Potato& potato) {
+        PotatoHop::note_load_hint(potato, left_id, right_id, left_load, right_load);
+    }
+    
+private:
+    static long ms_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    
+    // For load-aware policies: fresh outbound queue depths for both
+    // neighbors, and this player's own backlog carried to the receiver
+    void measure_load(Potato& potato) {
+        int message_size = MessageHeader::HEADER_SIZE + potato.get_serialized_size();
+        left_load.outbound = outbound_depth(left_fd, left_queue, left_id, message_size);
+        right_load.outbound = outbound_depth(right_fd, right_queue, right_id, message_size);
+        potato.set_load_hint(inbound_backlog(message_size));
+    }
+    
+    // Potatoes sent towards a neighbor that it has not taken off its socket
+    // yet, plus those still queued here because the socket was full
+    int outbound_depth(int fd, const SendQueue& queue, int neighbor_id, int message_size) {
+        if (datagram.is_open()) {
+            return datagram.unacked_count(neighbor_id);
+        }
+        return potatoes_in(NetworkUtils::queued_output(fd), message_size) + queue.size();
+    }
+    
+    // Potatoes waiting for this player, estimated from the unread bytes on
+    // the neighbor links. Packet sockets report only their next message, so
+    // the estimate undercounts there.
+    int inbound_backlog(int message_size) {
+        int bytes = 0;
+        if (datagram.is_open()) {
+            bytes = NetworkUtils::queued_input(datagram.get_fd());
+        } else {
+            bytes = NetworkUtils::queued_input(left_fd) + NetworkUtils::queued_input(right_fd);
+        }
+        return potatoes_in(bytes, message_size);
+    }
+    
+    // Messages of about message_size needed to hold bytes, rounded up
+    static int potatoes_in(int bytes, int message_size) {
+        return (bytes + message_size - 1) / message_size;
+    }
+    
+    // Send the potato to one neighbor; returns false (and drops the link) on
+    // failure. Never blocks: if the link is full the potato waits in its
+    // queue until select() reports room.
+    bool send_to_neighbor(int& fd, SendQueue& queue, int neighbor_id, NeighborLoad& load, const Potato& potato) {
+        if (datagram.is_open()) {
+            POTATO_PROBE(SEND_START, potato.get_id(), potato.get_hops());
+            bool sent = datagram.send<POTATO_TRANSFER>(neighbor_id, potato);
+            POTATO_PROBE(SEND_DONE, potato.get_id(), potato.get_hops());
+            if (!sent) {
+                return false;
+            }
+            load.note_sent(forwarded++);
+            LOG_MSG(LOG_LEVEL_INFO, "Sending potato to %d", neighbor_id);
+            return true;
+        }
+        if (fd < 0) {
+            return false;
+        }
+        POTATO_PROBE(SEND_START, potato.get_id(), potato.get_hops());
+        queue.push<POTATO_TRANSFER>(potato);
+        bool sent = queue.flush(fd);
+        POTATO_PROBE(SEND_DONE, potato.get_id(), potato.get_hops());
+        if (!sent) {
+            drop_link(fd, queue);
+            return false;
+        }
+        load.note_sent(forwarded++);
+        LOG_MSG(LOG_LEVEL_INFO, "Sending potato to %d", neighbor_id);
+        return true;
+    }
+    
+    // Hand the potato to the ringmaster: a copy to checkpoint, or one no
+    // neighbor could take
+    template <MessageType Type>
+    void send_to_master(const Potato& potato) {
+        try {
+            POTATO_PROBE(SEND_START, potato.get_id(), potato.get_hops());
+            NetworkUtils::send<Type>(master_fd, potato);
+            POTATO_PROBE(SEND_DONE, potato.get_id(), potato.get_hops());
+            last_master_send = std::chrono::steady_clock::now();
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 };
 
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <machine_name> <port_num> [--log-level debug|info|warn|error|off]"
+              << " [--udp-loss RATE] [--cpus LIST] [--numa-node N] [--probe-file FILE]" << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     // Check command line arguments
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <machine_name> <port_num>" << std::endl;
+    if (argc < 3) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
     
     // Parse arguments
     std::string master_hostname(argv[1]);
     int master_port = std::atoi(argv[2]);
+    double udp_loss = 0;  // Fraction of datagrams to drop, for testing
+    std::string cpu_list; // CPUs players may be pinned to ("" = no pinning)
+    int numa_node = -1;
+    std::string probe_path; // Where probe records are appended ("" = off)
+    
+    // Parse optional flags
+    for (int i = 3; i < argc; i++) {
+        std::string flag(argv[i]);
+        if (flag == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (!Logger::parse_level(argv[++i], &level)) {
+                std::cerr << "Error: unknown log level " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+            Logger::instance().set_level(level);
+        } else if (flag == "--udp-loss" && i + 1 < argc) {
+            udp_loss = std::atof(argv[++i]);
+            if (udp_loss < 0 || udp_loss >= 1) {
+                std::cerr << "Error: UDP loss rate must be in [0, 1)" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (flag == "--cpus" && i + 1 < argc) {
+            cpu_list = argv[++i];
+        } else if (flag == "--numa-node" && i + 1 < argc) {
+            if (!CpuPlacement::parse_numa_node(argv[++i], &numa_node)) {
+                std::cerr << "Error: bad NUMA node " << argv[i] << std::endl;
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (flag == "--probe-file" && i + 1 < argc) {
+            probe_path = argv[++i];
+        } else {
+            std::cerr << "Error: unknown option " << flag << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
     
     // Validate arguments
     if (master_port < 1 || master_port > 65535) {
@@ -253,9 +713,25 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
     
+    CpuPlacement placement;
+    try {
+        placement = CpuPlacement(cpu_list, numa_node);
+    } catch (const PlacementError& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    if (!probe_path.empty()) {
+        ProbeRecorder::instance().start(probe_path);
+    }
+    
     // Create player and run the game
-    Player player(master_hostname, master_port);
+    Player player(master_hostname, master_port, udp_loss, placement);
     player.play_game();
+    if (!ProbeRecorder::instance().dump()) {
+        std::cerr << "Failed to write probe records to " << probe_path << std::endl;
+    }
+    Logger::instance().flush();
     
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -2,27 +2,44 @@
 #define POTATO_H
 
 #include <iostream>
+#include <cstring>
 #include <string>
 #include <vector>
 
+#include "message_codec.h"
+
 #define MAX_HOPS 512
 
 // Potato class: represents the "hot potato" that gets passed between players
 class Potato {
 private:
+    int id;                // Distinguishes potatoes when several are in flight
     int remaining_hops;
+    int epoch;             // Ring epoch the potato was (re)injected in
+    int load_hint;         // Sender's backlog of potatoes when it passed this one on
     std::vector<int> trace;
 
 public:
     // Default constructor - creates a potato with 0 hops
-    Potato() : remaining_hops(0) {}
+    Potato() : id(0), remaining_hops(0), epoch(0), load_hint(0) {}
     
     // Create a potato with a specific number of hops
-    Potato(int hops) : remaining_hops(hops) {}
+    Potato(int hops, int potato_id = 0) : id(potato_id), remaining_hops(hops), epoch(0), load_hint(0) {}
+    
+    // Get the potato ID
+    int get_id() const { return id; }
     
     // Get the number of remaining hops
     int get_hops() const { return remaining_hops; }
     
+    // Get/set the ring epoch; potatoes from an older epoch are stale
+    int get_epoch() const { return epoch; }
+    void set_epoch(int new_epoch) { epoch = new_epoch; }
+    
+    // Get/set the load hint piggybacked for the receiving neighbor
+    int get_load_hint() const { return load_hint; }
+    void set_load_hint(int hint) { load_hint = hint; }
+    
     // Decrement the number of hops
     void decrement_hop() { remaining_hops--; }
     
@@ -31,6 +48,11 @@ public:
         trace.push_back(player_id);
     }
     
+    // Make room for a trace of this many hops up front
+    void reserve_trace(int hops) {
+        trace.reserve(hops);
+    }
+    
     // Get the trace as a comma-separated string
     std::string get_trace_string() const {
         if (trace.empty()) return "";
@@ -48,33 +70,41 @@ public:
         return trace;
     }
     
+    // Fixed part of the wire format; the trace length and trace follow it
+    typedef FieldList<MESSAGE_FIELD(Potato, id),
+                      MESSAGE_FIELD(Potato, remaining_hops),
+                      MESSAGE_FIELD(Potato, epoch),
+                      MESSAGE_FIELD(Potato, load_hint)> HeaderFields;
+    
+    // Offset of the trace length in the serialized potato
+    static constexpr int TRACE_SIZE_OFFSET = HeaderFields::SIZE;
+    
     // Serialize the potato for network transmission
     void serialize(char* buffer) const {
-        int* int_buf = reinterpret_cast<int*>(buffer);
-        int_buf[0] = remaining_hops;
-        int_buf[1] = static_cast<int>(trace.size());
+        HeaderFields::write(*this, buffer);
         
-        for (size_t i = 0; i < trace.size(); i++) {
-            int_buf[2 + i] = trace[i];
+        int trace_size = static_cast<int>(trace.size());
+        std::memcpy(buffer + TRACE_SIZE_OFFSET, &trace_size, sizeof(int));
+        if (trace_size > 0) {
+            std::memcpy(buffer + TRACE_SIZE_OFFSET + sizeof(int), trace.data(), trace_size * sizeof(int));
         }
     }
     
     // Deserialize the potato from network transmission
     void deserialize(const char* buffer) {
-        const int* int_buf = reinterpret_cast<const int*>(buffer);
-        remaining_hops = int_buf[0];
+        HeaderFields::read(*this, buffer);
         
-        int trace_size = int_buf[1];
-        trace.clear();
-        
-        for (int i = 0; i < trace_size; i++) {
-            trace.push_back(int_buf[2 + i]);
+        int trace_size;
+        std::memcpy(&trace_size, buffer + TRACE_SIZE_OFFSET, sizeof(int));
+        trace.resize(trace_size);
+        if (trace_size > 0) {
+            std::memcpy(trace.data(), buffer + TRACE_SIZE_OFFSET + sizeof(int), trace_size * sizeof(int));
         }
     }
     
     // Get the size of the serialized potato
     static int get_serialized_size(int trace_size) {
-        return (2 + trace_size) * sizeof(int);
+        return TRACE_SIZE_OFFSET + (1 + trace_size) * sizeof(int);
     }
     
     // Get the size of the serialized potato
@@ -88,47 +118,64 @@ enum MessageType {
     SETUP_INFO = 1,       // Initial setup info
     NEIGHBOR_INFO = 2,    // Neighbor connection info
     POTATO_TRANSFER = 3,  // Potato being passed
-    GAME_OVER = 4         // Signal game termination
+    GAME_OVER = 4,        // Signal game termination
+    HEARTBEAT = 5,        // Player liveness signal to the ringmaster
+    CHECKPOINT = 6,       // Copy of the in-flight potato for recovery
+    PLAYER_READY = 7,     // Player's listening port, sent after setup
+    MUX_OPEN = 8,         // Open a link through the link relays
+    MUX_CLOSE = 9,        // A relayed link was closed at the other end
+    ORPHANED_POTATO = 10, // Potato no neighbor link could take, to be re-injected
+    
+    FIRST_MESSAGE_TYPE = SETUP_INFO,
+    LAST_MESSAGE_TYPE = ORPHANED_POTATO
+};
+
+// How a link between two players is carried
+enum Transport {
+    TRANSPORT_TCP = 0,   // TCP over IPv4/IPv6, works between any hosts
+    TRANSPORT_UNIX = 1,  // AF_UNIX SOCK_SEQPACKET, players on the same host only
+    TRANSPORT_AUTO = 2,  // Ringmaster setting: UNIX between co-located players, else TCP
+    TRANSPORT_UDP = 3,   // One UDP socket per player for both neighbors, with acks
+    TRANSPORT_MUX = 4    // Through the link relays, one TCP connection per pair of hosts
 };
 
 // Structure for a network message header
 struct MessageHeader {
     MessageType type;
-    int size;  // Size of the payload
+    int size;     // Size of the payload
+    int channel;  // Logical link between two link relays; 0 on direct links
     
-    void serialize(char* buffer) const {
-        int* int_buf = reinterpret_cast<int*>(buffer);
-        int_buf[0] = static_cast<int>(type);
-        int_buf[1] = size;
-    }
+    MessageHeader() : type(FIRST_MESSAGE_TYPE), size(0), channel(0) {}
     
-    void deserialize(const char* buffer) {
-        const int* int_buf = reinterpret_cast<const int*>(buffer);
-        type = static_cast<MessageType>(int_buf[0]);
-        size = int_buf[1];
-    }
+    typedef FieldList<MESSAGE_FIELD(MessageHeader, type),
+                      MESSAGE_FIELD(MessageHeader, size),
+                      MESSAGE_FIELD(MessageHeader, channel)> Fields;
     
-    static const int HEADER_SIZE = 2 * sizeof(int);
+    static constexpr int HEADER_SIZE = Fields::SIZE;
+};
+
+// Payload of messages that carry no data
+struct EmptyMessage {
+    typedef FieldList<> Fields;
 };
 
 // Structure for setup information
 struct SetupInfo {
     int player_id;
     int total_players;
+    int heartbeat_ms;         // Heartbeat period, 0 disables heartbeats
+    int checkpoint_interval;  // Checkpoint every N hops, 0 disables checkpoints
+    int transport;            // Ringmaster's Transport setting for neighbor links
+    int forwarding_policy;    // ForwardingPolicyKind players pick neighbors with
+    int relay_port;           // Port of the link relay on every host (TRANSPORT_MUX)
     
-    void serialize(char* buffer) const {
-        int* int_buf = reinterpret_cast<int*>(buffer);
-        int_buf[0] = player_id;
-        int_buf[1] = total_players;
-    }
-    
-    void deserialize(const char* buffer) {
-        const int* int_buf = reinterpret_cast<const int*>(buffer);
-        player_id = int_buf[0];
-        total_players = int_buf[1];
-    }
-    
-    static const int SIZE = 2 * sizeof(int);
+    typedef FieldList<MESSAGE_FIELD(SetupInfo, player_id),
+                      MESSAGE_FIELD(SetupInfo, total_players),
+                      MESSAGE_FIELD(SetupInfo, heartbeat_ms),
+                      MESSAGE_FIELD(SetupInfo, checkpoint_interval),
+                      MESSAGE_FIELD(SetupInfo, transport),
+                      MESSAGE_FIELD(SetupInfo, forwarding_policy),
+                      MESSAGE_FIELD(SetupInfo, relay_port)> Fields;
 };
 
 // Structure for neighbor information
@@ -139,32 +186,162 @@ struct NeighborInfo {
     char right_ip[64];
     int left_port;
     int right_port;
+    int left_transport;   // Transport of the link from the left neighbor
+    int right_transport;  // Transport of the link to the right neighbor
     
-    void serialize(char* buffer) const {
-        int* int_buf = reinterpret_cast<int*>(buffer);
-        int_buf[0] = left_id;
-        int_buf[1] = right_id;
-        int_buf[2] = left_port;
-        int_buf[3] = right_port;
-        
-        char* char_buf = buffer + 4 * sizeof(int);
-        std::strncpy(char_buf, left_ip, 64);
-        std::strncpy(char_buf + 64, right_ip, 64);
+    typedef FieldList<MESSAGE_FIELD(NeighborInfo, left_id),
+                      MESSAGE_FIELD(NeighborInfo, right_id),
+                      MESSAGE_FIELD(NeighborInfo, left_port),
+                      MESSAGE_FIELD(NeighborInfo, right_port),
+                      MESSAGE_FIELD(NeighborInfo, left_transport),
+                      MESSAGE_FIELD(NeighborInfo, right_transport),
+                      MESSAGE_FIELD(NeighborInfo, left_ip),
+                      MESSAGE_FIELD(NeighborInfo, right_ip)> Fields;
+    
+    static NeighborInfo make(int left_id, int right_id,
+                             const std::string& left_ip, const std::string& right_ip,
+                             int left_port, int right_port,
+                             int left_transport, int right_transport) {
+        NeighborInfo info;
+        info.left_id = left_id;
+        info.right_id = right_id;
+        info.left_port = left_port;
+        info.right_port = right_port;
+        info.left_transport = left_transport;
+        info.right_transport = right_transport;
+        std::strncpy(info.left_ip, left_ip.c_str(), sizeof(info.left_ip));
+        std::strncpy(info.right_ip, right_ip.c_str(), sizeof(info.right_ip));
+        return info;
     }
+};
+
+// Structure for a player announcing where it accepts neighbor connections
+struct PlayerReady {
+    int listen_port;
+    int cpu;        // CPU the player is pinned to (-1 = not pinned)
+    int numa_node;  // NUMA node its memory comes from (-1 = kernel default)
     
-    void deserialize(const char* buffer) {
-        const int* int_buf = reinterpret_cast<const int*>(buffer);
-        left_id = int_buf[0];
-        right_id = int_buf[1];
-        left_port = int_buf[2];
-        right_port = int_buf[3];
+    typedef FieldList<MESSAGE_FIELD(PlayerReady, listen_port),
+                      MESSAGE_FIELD(PlayerReady, cpu),
+                      MESSAGE_FIELD(PlayerReady, numa_node)> Fields;
+};
+
+// Structure for opening a relayed link. A player sends it to its own
+// host's relay with the neighbor's address; between relays the host is
+// left empty and the channel ID in the header names the new link.
+struct MuxOpen {
+    int port;       // The neighbor's listening port
+    char host[64];  // The neighbor's host
+    
+    typedef FieldList<MESSAGE_FIELD(MuxOpen, port),
+                      MESSAGE_FIELD(MuxOpen, host)> Fields;
+    
+    static MuxOpen make(const std::string& host, int port) {
+        MuxOpen open;
+        open.port = port;
+        std::strncpy(open.host, host.c_str(), sizeof(open.host));
+        open.host[sizeof(open.host) - 1] = '\0';
+        return open;
+    }
+};
+
+// Codec for each payload type; fixed-size messages use the generated one
+template <typename Payload>
+struct MessageCodec : FixedCodec<Payload> {};
+
+// Potatoes carry a variable-length trace and encode themselves
+template <>
+struct MessageCodec<Potato> {
+    static int size(const Potato& potato) { return potato.get_serialized_size(); }
+    
+    static void serialize(const Potato& potato, char* buffer) {
+        potato.serialize(buffer);
+    }
+    
+    // Returns false if the trace length does not match the payload size
+    static bool deserialize(Potato& potato, const char* buffer, int size) {
+        int trace_size;
+        if (size < Potato::get_serialized_size(0)) {
+            return false;
+        }
+        std::memcpy(&trace_size, buffer + Potato::TRACE_SIZE_OFFSET, sizeof(int));
         
-        const char* char_buf = buffer + 4 * sizeof(int);
-        std::strncpy(left_ip, char_buf, 64);
-        std::strncpy(right_ip, char_buf + 64, 64);
+        // Bound the length by the payload before computing a size from it,
+        // so a huge trace_size cannot wrap around and pass the check
+        int max_trace_size = (size - Potato::get_serialized_size(0)) / static_cast<int>(sizeof(int));
+        if (trace_size < 0 || trace_size > max_trace_size || Potato::get_serialized_size(trace_size) != size) {
+            return false;
+        }
+        potato.deserialize(buffer);
+        return true;
+    }
+};
+
+// Payload type carried by each message type. Declaring a new message costs
+// one MessageType value plus one DECLARE_MESSAGE line.
+template <MessageType Type>
+struct MessagePayload;
+
+#define DECLARE_MESSAGE(message_type, Payload) \
+    template <> \
+    struct MessagePayload<message_type> { typedef Payload type; }
+
+DECLARE_MESSAGE(SETUP_INFO, SetupInfo);
+DECLARE_MESSAGE(NEIGHBOR_INFO, NeighborInfo);
+DECLARE_MESSAGE(POTATO_TRANSFER, Potato);
+DECLARE_MESSAGE(GAME_OVER, EmptyMessage);
+DECLARE_MESSAGE(HEARTBEAT, EmptyMessage);
+DECLARE_MESSAGE(CHECKPOINT, Potato);
+DECLARE_MESSAGE(PLAYER_READY, PlayerReady);
+DECLARE_MESSAGE(MUX_OPEN, MuxOpen);
+DECLARE_MESSAGE(MUX_CLOSE, EmptyMessage);
+DECLARE_MESSAGE(ORPHANED_POTATO, Potato);
+
+// Tag passed to handlers so each message type selects its own overload
+template <MessageType Type>
+struct MessageTag {};
+
+// Decodes a received message and calls handler.on_message(MessageTag<T>(), payload)
+// through a table indexed by message type, generated at compile time.
+// Handlers overload on_message for the types they expect and may catch the
+// rest with a template overload.
+template <typename Handler>
+class MessageDispatcher {
+private:
+    typedef bool (*Entry)(Handler&, const char*, int);
+    
+    template <MessageType Type>
+    static bool decode(Handler& handler, const char* data, int size) {
+        typename MessagePayload<Type>::type payload;
+        if (!MessageCodec<typename MessagePayload<Type>::type>::deserialize(payload, data, size)) {
+            return false;
+        }
+        handler.on_message(MessageTag<Type>(), payload);
+        return true;
+    }
+    
+    template <int... Types>
+    static const Entry* table(IntSequence<Types...>) {
+        static const Entry entries[] = { &decode<static_cast<MessageType>(Types)>... };
+        return entries;
     }
     
-    static const int SIZE = 4 * sizeof(int) + 128;
+public:
+    // Returns false for an unknown message type or a malformed payload
+    static bool dispatch(Handler& handler, const MessageHeader& header, const std::vector<char>& data) {
+        unsigned index = static_cast<unsigned>(header.type) - FIRST_MESSAGE_TYPE;
+        if (index > LAST_MESSAGE_TYPE - FIRST_MESSAGE_TYPE) {
+            return false;
+        }
+        static const Entry* entries = table(MakeIntSequence<FIRST_MESSAGE_TYPE, LAST_MESSAGE_TYPE + 1>());
+        return entries[index](handler, data.data(), header.size);
+    }
 };
 
-#endif // POTATO_H
\ No newline at end of file
+// Dispatch a received message to a handler
+template <typename Handler>
+bool dispatch_message(Handler& handler, const MessageHeader& header, const std::vector<char>& data) {
+    return MessageDispatcher<Handler>::dispatch(handler, header, data);
+}
+
+#endif // POTATO_H
@@ -0,0 +1,63 @@
+#ifndef POTATO_HOP_H
+#define POTATO_HOP_H
+
+#include <random>
+#include <vector>
+
+#include "potato.h"
+#include "forwarding_policy.h"
+
+// What a player does with a potato it has just been handed. The player and
+// the simulator both decide each hop here, so the simulated game follows the
+// same rules as the real one; only how the potato is then sent differs.
+struct PotatoHop {
+    bool finished;     // No hops left: the potato goes back to the ringmaster
+    bool checkpoint;   // Leave a copy with the ringmaster before passing it on
+    Direction side;    // Neighbor the policy picked, if not finished
+
+    // Count the hop, add player_id to the trace and decide where the potato
+    // goes next. measure_load(potato) is called only for load-aware policies,
+    // to refresh the outbound depths in left and right and set the potato's
+    // load hint to the player's own backlog.
+    template <typename MeasureLoad>
+    static PotatoHop take(Potato& potato, int player_id, int checkpoint_interval, ForwardingPolicy& policy,
+                          NeighborLoad& left, NeighborLoad& right, std::mt19937& rng,
+                          MeasureLoad measure_load) {
+        PotatoHop hop;
+        potato.decrement_hop();
+        potato.add_to_trace(player_id);
+
+        hop.finished = potato.get_hops() == 0;
+        hop.checkpoint = !hop.finished && checkpoint_interval > 0 &&
+                         potato.get_hops() % checkpoint_interval == 0;
+        hop.side = DIRECTION_LEFT;
+        if (!hop.finished) {
+            if (policy.uses_load()) {
+                left.note_hop();
+                right.note_hop();
+                measure_load(potato);
+            }
+            hop.side = policy.choose(left, right, rng);
+        }
+        return hop;
+    }
+
+    // Remember the backlog a neighbor reported on the potato it just sent.
+    // The sender is the last player in the trace. In a ring of two it is
+    // both neighbors, and the report holds for both links.
+    static void note_load_hint(const Potato& potato, int left_id, int right_id,
+                               NeighborLoad& left, NeighborLoad& right) {
+        const std::vector<int>& trace = potato.get_trace();
+        if (trace.empty()) {
+            return;
+        }
+        if (trace.back() == left_id) {
+            left.note_hint(potato.get_load_hint());
+        }
+        if (trace.back() == right_id) {
+            right.note_hint(potato.get_load_hint());
+        }
+    }
+};
+
+#endif // POTATO_HOP_H
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <cstdlib>
+
+#include "potato_hop.h"
+
+static int failed = 0;
+
+static void expect_loads(const char* what, const NeighborLoad& left, const NeighborLoad& right,
+                         int left_load, int right_load) {
+    if (left.load() != left_load || right.load() != right_load) {
+        std::cerr << what << ": loads " << left.load() << "/" << right.load()
+                  << ", expected " << left_load << "/" << right_load << std::endl;
+        failed++;
+    }
+}
+
+// A potato last held by sender, reporting backlog
+static Potato potato_from(int sender, int backlog) {
+    Potato potato(10);
+    potato.add_to_trace(sender);
+    potato.set_load_hint(backlog);
+    return potato;
+}
+
+// Check which neighbor's load a reported backlog lands on
+int main() {
+    // Distinct neighbors: only the sender's side takes the report
+    {
+        NeighborLoad left, right;
+        PotatoHop::note_load_hint(potato_from(3, 5), 3, 7, left, right);
+        expect_loads("report from the left neighbor", left, right, 5, 0);
+        PotatoHop::note_load_hint(potato_from(7, 2), 3, 7, left, right);
+        expect_loads("report from the right neighbor", left, right, 5, 2);
+        PotatoHop::note_load_hint(potato_from(9, 4), 3, 7, left, right);
+        expect_loads("report from a non-neighbor", left, right, 5, 2);
+    }
+
+    // Ring of two: the one neighbor is on both sides, and so is its report
+    {
+        NeighborLoad left, right;
+        left.note_sent(0);
+        right.note_sent(1);
+        PotatoHop::note_load_hint(potato_from(1, 6), 1, 1, left, right);
+        expect_loads("report in a ring of two", left, right, 6, 6);
+    }
+
+    std::cout << (failed == 0 ? "Load hints land on the right neighbors" : "Load hint checks failed") << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Per-stage latency breakdown of the player's potato path.
+
+Input is lines of "pid ns stage potato hops", from one or more files (or
+stdin), as written by `player --probe-file FILE`. The same lines come from
+the USDT probes of a player built with `make USDT=1`:
+
+    bpftrace -e 'usdt:./player:hot_potato:* {
+        printf("%d %llu %s %d %d\\n", pid, nsecs, probe, arg0, arg1); }'
+
+Each interval between two consecutive probes of one process is charged to
+the stage that ends it:
+
+    select           select_enter  -> select_wakeup
+    receive_message  ...           -> receive_done
+    deserialize      receive_done  -> decode_done
+    dispatch         decode_done   -> handle_start
+    handle_potato    ...           -> send_start
+    send_potato      send_start    -> send_done
+    loop             send_done     -> select_enter
+
+Intervals are attributed to the potato of the next tagged probe in the same
+process; those that end before one (a heartbeat, a neighbor update) count
+as "no potato". --folded writes "pid;potato;stage microseconds" lines that
+flamegraph.pl renders directly.
+"""
+
+import argparse
+import collections
+import sys
+
+STAGES = {
+    "select_wakeup": "select",
+    "receive_done": "receive_message",
+    "decode_done": "deserialize",
+    "handle_start": "dispatch",
+    "send_start": "handle_potato",
+    "send_done": "send_potato",
+    "select_enter": "loop",
+}
+ORDER = ["select", "receive_message", "deserialize", "dispatch",
+         "handle_potato", "send_potato", "loop"]
+
+
+def read_events(streams):
+    """Yield (pid, ns, probe, potato, hops); bad lines are skipped."""
+    for stream in streams:
+        for line in stream:
+            fields = line.split()
+            if len(fields) != 5:
+                continue
+            try:
+                pid, ns, potato, hops = int(fields[0]), int(fields[1]), int(fields[3]), int(fields[4])
+            except ValueError:
+                continue
+            # bpftrace prints the full probe name, e.g. usdt:./player:hot_potato:SEND_DONE
+            probe = fields[2].rsplit(":", 1)[-1].lower()
+            if probe in STAGES:
+                yield pid, ns, probe, potato, hops
+
+
+def percentile(values, fraction):
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("files", nargs="*", help="probe record files (default: stdin)")
+    parser.add_argument("--idle", action="store_true", help="include time blocked in select")
+    parser.add_argument("--folded", metavar="FILE", help="write folded stacks for flamegraph.pl")
+    args = parser.parse_args()
+
+    streams = [open(name) for name in args.files] if args.files else [sys.stdin]
+    by_pid = collections.defaultdict(list)
+    for pid, ns, probe, potato, hops in read_events(streams):
+        by_pid[pid].append((ns, probe, potato, hops))
+
+    samples = collections.defaultdict(list)   # stage -> [ns]
+    folded = collections.Counter()            # "pid;potato;stage" -> ns
+    visits = []                               # decode_done -> send_done, ns
+    for pid, events in by_pid.items():
+        events.sort()
+        pending = []        # (stage, ns) not yet tied to a potato
+        visit_start = None
+        for (prev_ns, _, _, _), (ns, probe, potato, _) in zip(events, events[1:]):
+            pending.append((STAGES[probe], ns - prev_ns))
+            if probe == "decode_done":
+                visit_start = ns
+            elif probe == "send_done" and visit_start is not None:
+                visits.append(ns - visit_start)
+                visit_start = None
+            if potato >= 0 or probe == "select_enter":
+                owner = "potato %d" % potato if potato >= 0 else "no potato"
+                for stage, duration in pending:
+                    samples[stage].append(duration)
+                    folded["%d;%s;%s" % (pid, owner, stage)] += duration
+                pending = []
+
+    stages = [stage for stage in ORDER if samples[stage] and (args.idle or stage != "select")]
+    if not stages:
+        print("No probe records", file=sys.stderr)
+        return 1
+    total = sum(sum(samples[stage]) for stage in stages)
+    print("%-16s %9s %11s %7s %10s %10s %10s %10s" %
+          ("stage", "count", "total ms", "share", "mean us", "p50 us", "p99 us", "max us"))
+    for stage in stages:
+        values = sorted(samples[stage])
+        print("%-16s %9d %11.3f %6.1f%% %10.2f %10.2f %10.2f %10.2f" %
+              (stage, len(values), sum(values) / 1e6, 100.0 * sum(values) / total,
+               sum(values) / len(values) / 1e3, percentile(values, 0.5) / 1e3,
+               percentile(values, 0.99) / 1e3, values[-1] / 1e3))
+    if visits:
+        visits.sort()
+        print("Per hop (decode to send done): %d hops, p50 %.2f us, p99 %.2f us, max %.2f us" %
+              (len(visits), percentile(visits, 0.5) / 1e3, percentile(visits, 0.99) / 1e3,
+               visits[-1] / 1e3))
+
+    if args.folded:
+        with open(args.folded, "w") as out:
+            for stack, duration in sorted(folded.items()):
+                if args.idle or not stack.endswith(";select"):
+                    out.write("%s %d\n" % (stack, max(1, duration // 1000)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,139 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Static probes on the player's potato path. Each probe is tagged with the
+// potato ID and its hops left (-1 for both before the potato is decoded).
+//
+// Built with -DHOT_POTATO_USDT (make USDT=1), every probe is also a USDT
+// probe in provider "hot_potato", a single nop until perf or bpftrace
+// attaches to it. Otherwise, and in addition, --probe-file turns on an
+// in-process ring of records that is written out when the player exits.
+// With neither, a probe costs one relaxed load and a branch.
+#if defined(HOT_POTATO_USDT)
+#include <sys/sdt.h>
+#define PROBE_USDT(stage, potato_id, hops) DTRACE_PROBE2(hot_potato, stage, potato_id, hops)
+#else
+#define PROBE_USDT(stage, potato_id, hops) do { } while (0)
+#endif
+
+// Probe points, in the order a potato passes them
+enum ProbeStage {
+    PROBE_SELECT_ENTER = 0,   // About to block in select()
+    PROBE_SELECT_WAKEUP = 1,  // select() returned
+    PROBE_RECEIVE_DONE = 2,   // receive_message() has the raw message
+    PROBE_DECODE_DONE = 3,    // Potato deserialized, handler called
+    PROBE_HANDLE_START = 4,   // handle_potato() entered
+    PROBE_SEND_START = 5,     // About to send the potato on
+    PROBE_SEND_DONE = 6,      // Send returned
+    PROBE_STAGE_COUNT = 7
+};
+
+#define POTATO_PROBE(stage, potato_id, hops) \
+    do { \
+        PROBE_USDT(stage, potato_id, hops); \
+        if (ProbeRecorder::instance().enabled()) { \
+            ProbeRecorder::instance().record(PROBE_##stage, potato_id, hops); \
+        } \
+    } while (0)
+
+// Fixed-size ring of probe records for one single-threaded process. Once
+// full, the oldest records are overwritten so a long run keeps its end.
+class ProbeRecorder {
+private:
+    struct Record {
+        uint64_t ns;
+        int32_t stage;
+        int32_t potato_id;
+        int32_t hops;
+    };
+
+    std::atomic<bool> on;
+    std::vector<Record> records;
+    uint64_t next;     // Records written so far; next % size is the slot
+    std::string path;
+
+    ProbeRecorder() : on(false), next(0) {}
+
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+    static ProbeRecorder& instance() {
+        static ProbeRecorder recorder;
+        return recorder;
+    }
+
+    // Start recording into a ring of capacity records, dumped to path by dump()
+    void start(const std::string& file, size_t capacity = DEFAULT_CAPACITY) {
+        path = file;
+        records.assign(capacity, Record());
+        next = 0;
+        on.store(true, std::memory_order_relaxed);
+    }
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    void record(int stage, int potato_id, int hops) {
+        Record& slot = records[next % records.size()];
+        slot.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        slot.stage = stage;
+        slot.potato_id = potato_id;
+        slot.hops = hops;
+        next++;
+    }
+
+    static const char* stage_name(int stage) {
+        static const char* const names[] = {
+            "select_enter", "select_wakeup", "receive_done", "decode_done",
+            "handle_start", "send_start", "send_done"
+        };
+        return stage >= 0 && stage < PROBE_STAGE_COUNT ? names[stage] : "unknown";
+    }
+
+    // Append the records, oldest first, as "pid ns stage potato hops" lines
+    // (the format of the bpftrace one-liner in probe_report.py). Players
+    // may share one file: it is opened for appending and written in whole
+    // lines. Returns false if the file could not be written.
+    bool dump() {
+        if (!enabled()) {
+            return true;
+        }
+        on.store(false, std::memory_order_relaxed);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        uint64_t first = next > records.size() ? next - records.size() : 0;
+        std::string batch;
+        bool ok = true;
+        char line[96];
+        for (uint64_t i = first; i < next && ok; i++) {
+            const Record& r = records[i % records.size()];
+            int length = snprintf(line, sizeof(line), "%d %llu %s %d %d\n", static_cast<int>(getpid()),
+                                  static_cast<unsigned long long>(r.ns), stage_name(r.stage),
+                                  r.potato_id, r.hops);
+            batch.append(line, length);
+            if (batch.size() >= (1 << 16) || i + 1 == next) {
+                ok = ::write(fd, batch.data(), batch.size()) == static_cast<ssize_t>(batch.size());
+                batch.clear();
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
+    // Records lost to the ring wrapping around
+    uint64_t overwritten() const { return next > records.size() ? next - records.size() : 0; }
+};
+
+#endif // PROBES_H
@@ -0,0 +1,611 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "potato.h"
+#include "network_utils.h"
+
+// Set by SIGINT/SIGTERM; the relay reports its links and exits
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+// Link relay: one per host. Players reach it over AF_UNIX, and it carries
+// every neighbor link between players on this host and players on another
+// host over a single TCP connection per remote host. Each message crossing
+// that connection is tagged with the channel ID of its link in the message
+// header. Everything read in one poll round is queued first and then sent
+// with one send per remote host, so messages of many links share segments.
+//
+// Dialing another host's relay never blocks either: its frames queue on the
+// connection while the connect completes in the background.
+//
+// Queues are bounded: a player that falls MAX_QUEUED messages behind stops
+// the relay reading its host's connection, and a host connection with
+// MAX_PEER_OUT bytes unsent stops the relay reading the players that feed
+// it, so the slow side pushes back on the fast one instead of the relay
+// buffering without end.
+//
+//   player --unix--> relay ==TCP (channels)==> relay --unix--> player
+class LinkRelay {
+private:
+    // One player link passing through the relay
+    struct Channel {
+        int peer;  // Index into peers; -1 until the player has sent MUX_OPEN
+        int id;    // Channel ID on that peer's connection
+        std::deque<std::vector<char> > to_local;  // Messages the player has not taken yet
+    };
+
+    // A link a remote relay opened, while the player's accept backlog is full
+    struct Opening {
+        int port;
+        std::chrono::steady_clock::time_point deadline;  // Given up after this
+        std::deque<std::vector<char> > to_local;
+    };
+
+    // Connection to the relay of another host
+    struct Peer {
+        int fd;                   // -1 once the connection is gone
+        std::string host;
+        bool connecting;          // Dialed, and the connect has not completed yet
+        std::vector<ResolvedAddress> addresses;  // Left to try while connecting
+        size_t next_address;
+        std::chrono::steady_clock::time_point deadline;  // Next address tried after this
+        int next_channel;         // Odd IDs on the dialing side, even on the accepting side
+        std::vector<char> in;     // Received bytes that do not form a whole frame yet
+        std::vector<char> out;    // Frames queued for the next flush
+        size_t out_sent;
+        long frames;              // Frames sent
+        long sends;               // send() calls they took
+    };
+
+    int port;
+    int tcp_fd;
+    int unix_fd;
+    std::map<int, Channel> channels;                 // By the player-side socket
+    std::map<std::pair<int, int>, int> routes;       // (peer, channel ID) -> player-side socket
+    std::map<std::pair<int, int>, Opening> openings; // (peer, channel ID) -> link not connected yet
+    std::vector<Peer> peers;
+
+    static const int READ_CHUNK = 1 << 16;
+    static const int MAX_FRAME = 1 << 16;  // Frames must fit a player's packet socket
+    static const size_t MAX_QUEUED = 256;         // Messages waiting for one player
+    static const size_t MAX_PEER_OUT = 1 << 20;   // Bytes waiting for one remote host
+    static const int OPEN_TIMEOUT_MS = 5000;     // Also the limit for one relay connect attempt
+    static const int OPEN_RETRY_MS = 10;
+
+    static void set_nonblocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    static std::vector<char> encode(MessageType type, int channel, const char* data, int size) {
+        std::vector<char> frame(MessageHeader::HEADER_SIZE + size);
+        MessageHeader header;
+        header.type = type;
+        header.size = size;
+        header.channel = channel;
+        MessageHeader::Fields::write(header, frame.data());
+        if (size > 0) {
+            memcpy(frame.data() + MessageHeader::HEADER_SIZE, data, size);
+        }
+        return frame;
+    }
+
+    template <MessageType Type>
+    void queue_frame(int peer, int channel, const typename MessagePayload<Type>::type& payload) {
+        typedef MessageCodec<typename MessagePayload<Type>::type> Codec;
+        std::vector<char> data(Codec::size(payload));
+        Codec::serialize(payload, data.data());
+        queue_frame(peer, Type, channel, data.data(), data.size());
+    }
+
+    void queue_frame(int peer, MessageType type, int channel, const char* data, int size) {
+        if (peers[peer].fd < 0) {
+            return;
+        }
+        std::vector<char> frame = encode(type, channel, data, size);
+        peers[peer].out.insert(peers[peer].out.end(), frame.begin(), frame.end());
+        peers[peer].frames++;
+    }
+
+    int add_peer(int fd, const std::string& host, int first_channel) {
+        set_nonblocking(fd);
+        Peer peer;
+        peer.fd = fd;
+        peer.host = host;
+        peer.connecting = false;
+        peer.next_address = 0;
+        peer.next_channel = first_channel;
+        peer.out_sent = 0;
+        peer.frames = 0;
+        peer.sends = 0;
+        peers.push_back(peer);
+        return peers.size() - 1;
+    }
+
+    // Connection to host's relay, dialing it if there is none yet. A new
+    // connection is returned while its connect is still in progress.
+    int find_or_dial(const std::string& host) {
+        for (size_t i = 0; i < peers.size(); i++) {
+            if (peers[i].fd >= 0 && peers[i].host == host) {
+                return i;
+            }
+        }
+        std::vector<ResolvedAddress> addresses = NetworkUtils::resolve(host, port);
+        size_t next = 0;
+        int fd = NetworkUtils::start_connect(addresses, &next);
+        if (fd < 0) {
+            throw NetworkError("Failed to connect to " + host + ":" + std::to_string(port));
+        }
+        int peer = add_peer(fd, host, 1);
+        peers[peer].connecting = true;
+        peers[peer].addresses.swap(addresses);
+        peers[peer].next_address = next;
+        peers[peer].deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(OPEN_TIMEOUT_MS));
+        return peer;
+    }
+
+    // The connect to a dialed relay has settled, or timed out: on success
+    // the frames queued meanwhile go out, on failure the next address is
+    // tried, and once none is left the links waiting on it are closed
+    void finish_dial(int peer, bool settled) {
+        Peer& remote = peers[peer];
+        if (settled && NetworkUtils::finish_connect(remote.fd)) {
+            remote.connecting = false;
+            remote.addresses.clear();
+            std::cout << "Relay link to " << remote.host << " opened" << std::endl;
+            return;
+        }
+        close(remote.fd);
+        remote.fd = NetworkUtils::start_connect(remote.addresses, &remote.next_address);
+        if (remote.fd >= 0) {
+            remote.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(OPEN_TIMEOUT_MS));
+            return;
+        }
+        std::cerr << "Failed to connect to relay " << remote.host << ":" << port << std::endl;
+        drop_peer(peer);
+    }
+
+    // Dials that have taken too long move on to the next address
+    void expire_dials() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < peers.size(); i++) {
+            if (peers[i].fd >= 0 && peers[i].connecting && now >= peers[i].deadline) {
+                finish_dial(i, false);
+            }
+        }
+    }
+
+    void add_channel(int fd, int peer, int id) {
+        Channel channel;
+        channel.peer = peer;
+        channel.id = id;
+        channels[fd] = channel;
+        if (peer >= 0) {
+            routes[std::make_pair(peer, id)] = fd;
+        }
+    }
+
+    // Close a player-side link; with notify, the far side is told as well
+    void close_channel(int fd, bool notify) {
+        std::map<int, Channel>::iterator it = channels.find(fd);
+        if (it == channels.end()) {
+            return;
+        }
+        if (it->second.peer >= 0) {
+            if (notify) {
+                queue_frame<MUX_CLOSE>(it->second.peer, it->second.id, EmptyMessage());
+            }
+            routes.erase(std::make_pair(it->second.peer, it->second.id));
+        }
+        close(fd);
+        channels.erase(it);
+    }
+
+    // A remote relay went away: so do all the links through it
+    void drop_peer(int peer) {
+        std::vector<int> lost;
+        for (const auto& entry : channels) {
+            if (entry.second.peer == peer) {
+                lost.push_back(entry.first);
+            }
+        }
+        for (int fd : lost) {
+            close_channel(fd, false);
+        }
+        std::map<std::pair<int, int>, Opening>::iterator open = openings.begin();
+        while (open != openings.end()) {
+            if (open->first.first == peer) {
+                openings.erase(open++);
+            } else {
+                ++open;
+            }
+        }
+        std::cout << "Relay link to " << peers[peer].host << " closed: " << peers[peer].frames
+                  << " frames in " << peers[peer].sends << " sends" << std::endl;
+        if (peers[peer].fd >= 0) {
+            close(peers[peer].fd);
+        }
+        peers[peer].fd = -1;
+        peers[peer].in.clear();
+        peers[peer].out.clear();
+        peers[peer].out_sent = 0;
+    }
+
+    static size_t unsent(const Peer& remote) {
+        return remote.out.size() - remote.out_sent;
+    }
+
+    // Hand queued messages to a player without ever blocking the relay
+    void flush_local(int fd) {
+        std::deque<std::vector<char> >& queue = channels[fd].to_local;
+        while (!queue.empty()) {
+            ssize_t sent = ::send(fd, queue.front().data(), queue.front().size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    close_channel(fd, true);
+                }
+                return;
+            }
+            queue.pop_front();
+        }
+    }
+
+    // Send everything queued for a remote relay in as few calls as the
+    // socket allows; the rest waits for POLLOUT
+    void flush_peer(int peer) {
+        Peer& remote = peers[peer];
+        while (remote.fd >= 0 && remote.out_sent < remote.out.size()) {
+            ssize_t sent = ::send(remote.fd, remote.out.data() + remote.out_sent,
+                                  remote.out.size() - remote.out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    drop_peer(peer);
+                } else {
+                    // Keep only what is left, so the buffer stays bounded
+                    remote.out.erase(remote.out.begin(), remote.out.begin() + remote.out_sent);
+                    remote.out_sent = 0;
+                }
+                return;
+            }
+            remote.sends++;
+            remote.out_sent += sent;
+        }
+        if (remote.fd >= 0) {
+            remote.out.clear();
+            remote.out_sent = 0;
+        }
+    }
+
+    void accept_local() {
+        try {
+            add_channel(NetworkUtils::accept_connection(unix_fd), -1, 0);
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    void accept_peer() {
+        try {
+            std::string host;
+            int fd = NetworkUtils::accept_connection(tcp_fd, &host);
+            add_peer(fd, host, 2);
+            std::cout << "Relay link to " << host << " opened" << std::endl;
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    // A message from a player on this host
+    void read_local(int fd) {
+        std::vector<char> data;
+        MessageHeader header;
+        try {
+            header = NetworkUtils::receive_message(fd, data);
+        } catch (const NetworkError& e) {
+            close_channel(fd, true);
+            return;
+        }
+
+        // A closed link reads as GAME_OVER; players never send one to a neighbor
+        if (header.type == GAME_OVER) {
+            close_channel(fd, true);
+            return;
+        }
+
+        Channel& channel = channels[fd];
+        if (channel.peer >= 0) {
+            queue_frame(channel.peer, header.type, channel.id, data.data(), header.size);
+            return;
+        }
+
+        // The first message names the player on the other host
+        MuxOpen open;
+        if (header.type != MUX_OPEN || !MessageCodec<MuxOpen>::deserialize(open, data.data(), header.size)) {
+            close_channel(fd, false);
+            return;
+        }
+        int peer;
+        try {
+            peer = find_or_dial(open.host);
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+            close_channel(fd, false);
+            return;
+        }
+        int id = peers[peer].next_channel;
+        peers[peer].next_channel += 2;
+        channel.peer = peer;
+        channel.id = id;
+        routes[std::make_pair(peer, id)] = fd;
+        queue_frame<MUX_OPEN>(peer, id, MuxOpen::make("", open.port));
+    }
+
+    // Frames from another host's relay
+    void read_peer(int peer) {
+        Peer& remote = peers[peer];
+        size_t old_size = remote.in.size();
+        remote.in.resize(old_size + READ_CHUNK);
+        ssize_t received = recv(remote.fd, remote.in.data() + old_size, READ_CHUNK, 0);
+        if (received <= 0) {
+            remote.in.resize(old_size);
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                drop_peer(peer);
+            }
+            return;
+        }
+        remote.in.resize(old_size + received);
+
+        size_t offset = 0;
+        while (peers[peer].fd >= 0 && peers[peer].in.size() - offset >= static_cast<size_t>(MessageHeader::HEADER_SIZE)) {
+            MessageHeader header;
+            MessageHeader::Fields::read(header, peers[peer].in.data() + offset);
+            if (header.size < 0 || header.size > MAX_FRAME - MessageHeader::HEADER_SIZE) {
+                std::cerr << "Malformed frame from relay " << peers[peer].host << std::endl;
+                drop_peer(peer);
+                return;
+            }
+            size_t frame_size = MessageHeader::HEADER_SIZE + header.size;
+            if (peers[peer].in.size() - offset < frame_size) {
+                break;
+            }
+            handle_frame(peer, header, peers[peer].in.data() + offset + MessageHeader::HEADER_SIZE);
+            offset += frame_size;
+        }
+        if (peers[peer].fd >= 0) {
+            peers[peer].in.erase(peers[peer].in.begin(), peers[peer].in.begin() + offset);
+        }
+    }
+
+    // Connect to the player on this host as its neighbor would. The relay
+    // must not wait on a player whose accept backlog is full, so the link
+    // stays an opening, collecting its messages, until the player has room.
+    // Returns false once the link is settled either way.
+    bool try_open(int peer, int id, Opening& opening) {
+        try {
+            int fd = NetworkUtils::try_connect_unix(NetworkUtils::unix_socket_name(opening.port));
+            if (fd < 0) {
+                if (std::chrono::steady_clock::now() < opening.deadline) {
+                    return true;
+                }
+                throw NetworkError("Timed out connecting to the player on port " + std::to_string(opening.port));
+            }
+            add_channel(fd, peer, id);
+            channels[fd].to_local.swap(opening.to_local);
+            flush_local(fd);
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+            queue_frame<MUX_CLOSE>(peer, id, EmptyMessage());
+        }
+        return false;
+    }
+
+    void retry_openings() {
+        std::map<std::pair<int, int>, Opening>::iterator it = openings.begin();
+        while (it != openings.end()) {
+            if (try_open(it->first.first, it->first.second, it->second)) {
+                ++it;
+            } else {
+                openings.erase(it++);
+            }
+        }
+    }
+
+    void handle_frame(int peer, const MessageHeader& header, const char* data) {
+        std::pair<int, int> key = std::make_pair(peer, header.channel);
+        if (header.type == MUX_OPEN) {
+            MuxOpen open;
+            if (!MessageCodec<MuxOpen>::deserialize(open, data, header.size)) {
+                return;
+            }
+            Opening& opening = openings[key];
+            opening.port = open.port;
+            opening.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(OPEN_TIMEOUT_MS));
+            if (!try_open(peer, header.channel, opening)) {
+                openings.erase(key);
+            }
+            return;
+        }
+
+        std::map<std::pair<int, int>, int>::iterator route = routes.find(key);
+        if (route == routes.end()) {
+            std::map<std::pair<int, int>, Opening>::iterator opening = openings.find(key);
+            if (opening == openings.end()) {
+                return;  // Closed here while the frame was on its way
+            }
+            if (header.type == MUX_CLOSE) {
+                openings.erase(opening);
+            } else {
+                opening->second.to_local.push_back(encode(header.type, 0, data, header.size));
+            }
+            return;
+        }
+        int fd = route->second;
+        if (header.type == MUX_CLOSE) {
+            close_channel(fd, false);
+            return;
+        }
+        channels[fd].to_local.push_back(encode(header.type, 0, data, header.size));
+        flush_local(fd);
+    }
+
+public:
+    LinkRelay(int relay_port) : port(relay_port) {
+        try {
+            tcp_fd = NetworkUtils::create_server_socket(port);
+            unix_fd = NetworkUtils::create_unix_server_socket(NetworkUtils::relay_socket_name(port));
+        } catch (const NetworkError& e) {
+            std::cerr << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::cout << "Link relay listening on port " << port << std::endl;
+    }
+
+    // Relay until asked to stop, then report what each link carried
+    void run() {
+        while (!stop_requested) {
+            // A host's connection is not read while one of its players is
+            // MAX_QUEUED messages behind
+            std::vector<bool> peer_backlogged(peers.size(), false);
+            for (const auto& entry : channels) {
+                if (entry.second.peer >= 0 && entry.second.to_local.size() >= MAX_QUEUED) {
+                    peer_backlogged[entry.second.peer] = true;
+                }
+            }
+            for (const auto& entry : openings) {
+                if (entry.second.to_local.size() >= MAX_QUEUED) {
+                    peer_backlogged[entry.first.first] = true;
+                }
+            }
+
+            std::vector<struct pollfd> fds;
+            struct pollfd listener = {tcp_fd, POLLIN, 0};
+            fds.push_back(listener);
+            listener.fd = unix_fd;
+            fds.push_back(listener);
+            for (const auto& entry : channels) {
+                // Nor is a player whose host connection has MAX_PEER_OUT bytes unsent
+                int peer = entry.second.peer;
+                struct pollfd local = {entry.first, 0, 0};
+                if (peer < 0 || unsent(peers[peer]) < MAX_PEER_OUT) {
+                    local.events |= POLLIN;
+                }
+                if (!entry.second.to_local.empty()) {
+                    local.events |= POLLOUT;
+                }
+                fds.push_back(local);
+            }
+            size_t first_peer = fds.size();
+            std::vector<int> peer_index;
+            bool dialing = false;
+            for (size_t i = 0; i < peers.size(); i++) {
+                if (peers[i].fd >= 0 && peers[i].connecting) {
+                    struct pollfd remote = {peers[i].fd, POLLOUT, 0};
+                    fds.push_back(remote);
+                    peer_index.push_back(i);
+                    dialing = true;
+                } else if (peers[i].fd >= 0) {
+                    struct pollfd remote = {peers[i].fd, 0, 0};
+                    if (!peer_backlogged[i]) {
+                        remote.events |= POLLIN;
+                    }
+                    if (!peers[i].out.empty()) {
+                        remote.events |= POLLOUT;
+                    }
+                    fds.push_back(remote);
+                    peer_index.push_back(i);
+                }
+            }
+
+            if (poll(fds.data(), fds.size(), openings.empty() && !dialing ? -1 : OPEN_RETRY_MS) < 0) {
+                if (errno == EINTR) {
+                    continue;  // Re-checks stop_requested
+                }
+                std::cerr << "Error in poll" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+            // Gather everything that is ready...
+            for (size_t i = 2; i < first_peer; i++) {
+                if (fds[i].revents == 0 || channels.find(fds[i].fd) == channels.end()) {
+                    continue;  // Idle, or closed earlier in this round
+                }
+                if (fds[i].revents & POLLOUT) {
+                    flush_local(fds[i].fd);
+                }
+                if (channels.find(fds[i].fd) != channels.end() && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    read_local(fds[i].fd);
+                }
+            }
+            for (size_t i = first_peer; i < fds.size(); i++) {
+                int peer = peer_index[i - first_peer];
+                if (peers[peer].fd < 0 || fds[i].revents == 0) {
+                    continue;
+                }
+                if (peers[peer].connecting) {
+                    finish_dial(peer, true);
+                } else if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    read_peer(peer);
+                }
+            }
+            if (fds[0].revents & POLLIN) {
+                accept_peer();
+            }
+            if (fds[1].revents & POLLIN) {
+                accept_local();
+            }
+            retry_openings();
+            expire_dials();
+
+            // ...then send it, one batch per remote host
+            for (size_t i = 0; i < peers.size(); i++) {
+                if (peers[i].fd >= 0 && !peers[i].connecting && !peers[i].out.empty()) {
+                    flush_peer(i);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < peers.size(); i++) {
+            if (peers[i].fd >= 0) {
+                drop_peer(i);
+            }
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // Check command line arguments
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <relay_port>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int port = std::atoi(argv[1]);
+    if (port < 1 || port > 65535) {
+        std::cerr << "Error: port must be between 1 and 65535" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    LinkRelay relay(port);
+    relay.run();
+    return EXIT_SUCCESS;
+}
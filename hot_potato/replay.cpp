@@ -0,0 +1,121 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <chrono>
+#include <utility>
+
+#include "potato.h"
+#include "network_utils.h"
+#include "snapshot.h"
+
+// Re-executes recorded potato traces through the same encode/decode path a
+// real hop takes (header and codec, then dispatch), with no sockets
+// involved, to benchmark the per-hop CPU cost and to check that a
+// snapshot's traces are self-consistent.
+class Replayer {
+private:
+    std::vector<Potato> recorded;
+    int iterations;
+    
+    // Takes the decoded potato the way a player's neighbor handler does
+    struct ReplayHandler {
+        Potato& potato;
+        
+        ReplayHandler(Potato& target) : potato(target) {}
+        
+        void on_message(MessageTag<POTATO_TRANSFER>, Potato& received) {
+            std::swap(potato, received);
+        }
+        
+        template <MessageType Type, typename Payload>
+        void on_message(MessageTag<Type>, Payload&) {}
+    };
+    
+    // Replay one recorded trace; returns false if the result does not match
+    static bool replay_potato(const Potato& record, long* hops_replayed) {
+        const std::vector<int>& trace = record.get_trace();
+        int total_hops = static_cast<int>(trace.size()) + record.get_hops();
+        
+        Potato potato(total_hops, record.get_id());
+        ReplayHandler handler(potato);
+        std::vector<char> wire;
+        std::vector<char> payload;
+        
+        for (int player : trace) {
+            // What the sending player puts on the wire...
+            NetworkUtils::encode<POTATO_TRANSFER>(potato, wire);
+            
+            // ...and what the receiving player does with it
+            MessageHeader header;
+            MessageHeader::Fields::read(header, wire.data());
+            payload.assign(wire.begin() + MessageHeader::HEADER_SIZE, wire.end());
+            if (header.type != POTATO_TRANSFER || !dispatch_message(handler, header, payload)) {
+                return false;
+            }
+            potato.decrement_hop();
+            potato.add_to_trace(player);
+        }
+        *hops_replayed += trace.size();
+        
+        return potato.get_hops() == record.get_hops() && potato.get_trace() == trace;
+    }
+
+public:
+    Replayer(const SnapshotState& state, int rounds)
+        : recorded(state.potatoes), iterations(rounds) {}
+    
+    int run() {
+        int mismatches = 0;
+        long hops_replayed = 0;
+        
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            for (const Potato& record : recorded) {
+                if (!replay_potato(record, &hops_replayed) && iteration == 0) {
+                    std::cerr << "Potato " << record.get_id() << ": replayed trace does not match" << std::endl;
+                    mismatches++;
+                }
+            }
+        }
+        double elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        
+        for (const Potato& record : recorded) {
+            std::cout << "Potato " << record.get_id() << ": " << record.get_trace().size()
+                      << " hops recorded, " << record.get_hops() << " remaining" << std::endl;
+        }
+        std::cout << "Replayed " << hops_replayed << " hops in " << elapsed_ns / 1e6 << " ms";
+        if (hops_replayed > 0) {
+            std::cout << " (" << elapsed_ns / hops_replayed << " ns/hop)";
+        }
+        std::cout << std::endl;
+        
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // Check command line arguments
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " <snapshot_file> [iterations]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    int iterations = argc == 3 ? std::atoi(argv[2]) : 1;
+    if (iterations < 1) {
+        std::cerr << "Error: iterations must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    SnapshotState state;
+    try {
+        state = GameSnapshot::load(argv[1]);
+    } catch (const SnapshotError& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    Replayer replayer(state, iterations);
+    return replayer.run();
+}
@@ -0,0 +1,180 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+// Exception class for name resolution failures
+class ResolverError : public std::runtime_error {
+public:
+    ResolverError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// One socket address a host name resolved to (IPv4 or IPv6)
+struct ResolvedAddress {
+    sockaddr_storage addr;
+    socklen_t length;
+    int family;
+
+    // Copy of this address with the port filled in
+    ResolvedAddress with_port(int port) const {
+        ResolvedAddress result = *this;
+        if (family == AF_INET6) {
+            reinterpret_cast<sockaddr_in6*>(&result.addr)->sin6_port = htons(port);
+        } else {
+            reinterpret_cast<sockaddr_in*>(&result.addr)->sin_port = htons(port);
+        }
+        return result;
+    }
+};
+
+// Thread-safe, caching name resolver built on getaddrinfo.
+// Lookups are cached per host name for the life of the process; the port is
+// applied afterwards, so every link to the same host shares one lookup.
+// Numeric addresses are parsed locally and never reach a name server.
+class Resolver {
+private:
+    std::mutex cache_mutex;  // Guards the cache only, never held across a lookup
+    std::map<std::string, std::vector<ResolvedAddress> > cache;
+
+    Resolver() {}
+
+    // Ask getaddrinfo for every stream address of host
+    static std::vector<ResolvedAddress> lookup(const std::string& host) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        // Literal addresses first: no resolver round trip at all
+        hints.ai_flags = AI_NUMERICHOST;
+        struct addrinfo* results = nullptr;
+        int status = getaddrinfo(host.c_str(), nullptr, &hints, &results);
+        if (status != 0) {
+            hints.ai_flags = AI_ADDRCONFIG;
+            status = getaddrinfo(host.c_str(), nullptr, &hints, &results);
+        }
+        if (status != 0) {
+            throw ResolverError("Failed to resolve hostname " + host + ": " + gai_strerror(status));
+        }
+
+        std::vector<ResolvedAddress> addresses;
+        for (struct addrinfo* ai = results; ai != nullptr; ai = ai->ai_next) {
+            if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
+                continue;
+            }
+            ResolvedAddress address;
+            memset(&address.addr, 0, sizeof(address.addr));
+            memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+            address.length = ai->ai_addrlen;
+            address.family = ai->ai_family;
+            addresses.push_back(address);
+        }
+        freeaddrinfo(results);
+
+        if (addresses.empty()) {
+            throw ResolverError("No usable address for hostname " + host);
+        }
+        return addresses;
+    }
+
+public:
+    Resolver(const Resolver&) = delete;
+    Resolver& operator=(const Resolver&) = delete;
+
+    static Resolver& instance() {
+        static Resolver resolver;
+        return resolver;
+    }
+
+    // All addresses of host with the given port, from the cache when possible
+    std::vector<ResolvedAddress> resolve(const std::string& host, int port) {
+        std::vector<ResolvedAddress> addresses;
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            std::map<std::string, std::vector<ResolvedAddress> >::const_iterator it = cache.find(host);
+            if (it != cache.end()) {
+                addresses = it->second;
+            }
+        }
+
+        if (addresses.empty()) {
+            addresses = lookup(host);
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache[host] = addresses;
+        }
+
+        for (size_t i = 0; i < addresses.size(); i++) {
+            addresses[i] = addresses[i].with_port(port);
+        }
+        return addresses;
+    }
+
+    // Resolve every uncached host concurrently and wait for all of them.
+    // Failures are left for the caller's later resolve() to report.
+    void prefetch(const std::vector<std::string>& hosts) {
+        std::vector<std::string> missing;
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            for (const std::string& host : hosts) {
+                if (!host.empty() && cache.find(host) == cache.end() &&
+                    std::find(missing.begin(), missing.end(), host) == missing.end()) {
+                    missing.push_back(host);
+                }
+            }
+        }
+        if (missing.size() == 1) {
+            prefetch_one(missing[0]);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        for (const std::string& host : missing) {
+            workers.push_back(std::thread(&Resolver::prefetch_one, this, host));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    // Numeric form of an address; IPv4-mapped IPv6 addresses are shown as IPv4
+    // and AF_UNIX peers, which are always on this host, as "localhost"
+    static std::string format_address(const sockaddr_storage& addr) {
+        char text[INET6_ADDRSTRLEN];
+        if (addr.ss_family == AF_UNIX) {
+            return "localhost";
+        }
+        if (addr.ss_family == AF_INET6) {
+            const sockaddr_in6* addr6 = reinterpret_cast<const sockaddr_in6*>(&addr);
+            if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr)) {
+                inet_ntop(AF_INET, &addr6->sin6_addr.s6_addr[12], text, sizeof(text));
+            } else {
+                inet_ntop(AF_INET6, &addr6->sin6_addr, text, sizeof(text));
+            }
+        } else {
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&addr)->sin_addr, text, sizeof(text));
+        }
+        return std::string(text);
+    }
+
+private:
+    void prefetch_one(const std::string& host) {
+        try {
+            resolve(host, 0);
+        } catch (const ResolverError& e) {
+            // Reported when the address is actually needed
+        }
+    }
+};
+
+#endif // RESOLVER_H
@@ -10,32 +10,96 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <chrono>
+#include <set>
 #include <time.h>
 
 #include "potato.h"
 #include "network_utils.h"
+#include "snapshot.h"
+#include "trace_file.h"
+#include "forwarding_policy.h"
+#include "placement.h"
+#include "trace_check.h"
+
+// Settings for one ringmaster run
+struct RingmasterConfig {
+    int port;
+    int num_players;
+    int num_hops;
+    int num_potatoes;          // Potatoes in flight at once
+    int heartbeat_ms;          // Player heartbeat period (0 = off)
+    int checkpoint_interval;   // Players checkpoint every N hops (0 = off)
+    std::string snapshot_path; // Game state snapshot file ("" = off)
+    int snapshot_ms;           // Minimum time between snapshot commits
+    std::string trace_path;    // Binary trace output file ("" = off)
+    bool trace_timestamps;     // Record launch/return times in the trace file
+    int teardown_ms;           // Longest wait for players to acknowledge game over
+    int transport;             // Transport for neighbor links (TRANSPORT_AUTO picks per link)
+    int forwarding_policy;     // How players pick the neighbor to pass to
+    int relay_port;            // Port of the link relay on every host (mux transport)
+    std::string cpu_list;      // CPUs the ringmaster runs on ("" = anywhere)
+    int numa_node;             // NUMA node for the ringmaster (-1 = any)
+    
+    RingmasterConfig()
+        : port(0), num_players(0), num_hops(0), num_potatoes(1),
+          heartbeat_ms(0), checkpoint_interval(0), snapshot_ms(1000),
+          trace_timestamps(false), teardown_ms(1000),
+          transport(TRANSPORT_AUTO), forwarding_policy(POLICY_RANDOM),
+          relay_port(0), numa_node(-1) {}
+};
 
 class Ringmaster {
 private:
     int num_players;
     int num_hops;
+    int num_potatoes;
     int server_fd;
     std::vector<int> player_fds;
     std::vector<std::string> player_ips;
     std::vector<int> player_ports;
+    std::vector<PlacementInfo> placements;  // Where each player reported it runs
+    std::vector<int> left_ids;   // Left neighbor each player was last told about
+    std::vector<int> right_ids;  // Right neighbor each player was last told about
+    int heartbeat_ms;            // Player heartbeat period (0 = off)
+    int checkpoint_interval;     // Players checkpoint every N hops (0 = off)
+    int epoch;                   // Bumped every time the potatoes are recovered
+    std::vector<Potato> checkpoints;    // Most advanced known copy of each potato
+    std::vector<bool> finished;         // Potatoes that made it back
+    std::vector<Potato> resume_potatoes; // Potato state to resume from, if any
+    std::vector<std::vector<size_t> > restarts;  // Trace lengths each potato was (re)sent at
+    std::set<std::pair<int, int> > repaired_links; // Neighbor pairs made by ring repairs
+    std::string snapshot_path;
+    int snapshot_ms;
+    GameSnapshot snapshot;
+    std::chrono::steady_clock::time_point last_commit;
+    std::string trace_path;
+    bool trace_timestamps;
+    TraceWriter trace_writer;
+    std::vector<uint64_t> launch_ns;    // When each potato was sent out
+    int teardown_ms;                    // Longest wait for players to acknowledge game over
+    int transport;                      // Transport for neighbor links
+    int forwarding_policy;              // ForwardingPolicyKind sent to the players
+    int relay_port;                     // Link relay port sent to the players
     std::mt19937 rng;  // Random number generator
 
 public:
-    Ringmaster(int port, int players, int hops) 
-        : num_players(players), num_hops(hops) {
+    Ringmaster(const RingmasterConfig& config)
+        : num_players(config.num_players), num_hops(config.num_hops),
+          num_potatoes(config.num_potatoes),
+          heartbeat_ms(config.heartbeat_ms), checkpoint_interval(config.checkpoint_interval),
+          epoch(0), snapshot_path(config.snapshot_path), snapshot_ms(config.snapshot_ms),
+          trace_path(config.trace_path), trace_timestamps(config.trace_timestamps),
+          teardown_ms(config.teardown_ms), transport(config.transport),
+          forwarding_policy(config.forwarding_policy), relay_port(config.relay_port) {
         // Initialize random number generator
         std::random_device rd;
         rng.seed(rd());
         
         // Create server socket
         try {
-            server_fd = NetworkUtils::create_server_socket(port);
+            server_fd = NetworkUtils::create_server_socket(config.port);
         } catch (const NetworkError& e) {
             std::cerr << e.what() << std::endl;
             exit(EXIT_FAILURE);
@@ -49,13 +113,38 @@ public:
     ~Ringmaster() {
         // Close all player connections
         for (int fd : player_fds) {
-            close(fd);
+            if (fd >= 0) {
+                close(fd);
+            }
         }
         
         // Close server socket
         close(server_fd);
     }
     
+    // Continue the potatoes of an earlier run instead of starting fresh ones
+    void resume_from(const SnapshotState& state) {
+        for (size_t i = 0; i < state.potatoes.size(); i++) {
+            const Potato& potato = state.potatoes[i];
+            int hops = potato.get_hops();
+            const std::vector<int>& trace = potato.get_trace();
+            if (potato.get_id() != static_cast<int>(i) || hops < 0 || hops > num_hops ||
+                trace.size() > static_cast<size_t>(num_hops - hops)) {
+                throw SnapshotError("Snapshot potato " + std::to_string(i) + " does not fit this game");
+            }
+            for (int player : trace) {
+                if (player < 0 || player >= num_players) {
+                    throw SnapshotError("Snapshot potato " + std::to_string(i) + " visited an unknown player");
+                }
+            }
+        }
+        resume_potatoes = state.potatoes;
+        num_potatoes = resume_potatoes.size();
+        for (Potato& potato : resume_potatoes) {
+            potato.set_epoch(0);
+        }
+    }
+    
     void setup_game() {
         // Wait for all players to connect
         for (int i = 0; i < num_players; i++) {
@@ -66,13 +155,23 @@ public:
                 player_ips.push_back(player_ip);
                 
                 // Send player its ID and the total number of players
-                NetworkUtils::send_setup_info(player_fd, i, num_players);
+                SetupInfo setup;
+                setup.player_id = i;
+                setup.total_players = num_players;
+                setup.heartbeat_ms = heartbeat_ms;
+                setup.checkpoint_interval = checkpoint_interval;
+                setup.transport = transport;
+                setup.forwarding_policy = forwarding_policy;
+                setup.relay_port = relay_port;
+                NetworkUtils::send<SETUP_INFO>(player_fd, setup);
                 
                 // Receive player's port for neighbor connections
-                std::vector<char> data;
-                NetworkUtils::receive_message(player_fd, data);
-                int player_port = *reinterpret_cast<int*>(data.data());
-                player_ports.push_back(player_port);
+                PlayerReady ready = NetworkUtils::receive<PLAYER_READY>(player_fd);
+                player_ports.push_back(ready.listen_port);
+                PlacementInfo placed;
+                placed.cpu = ready.cpu;
+                placed.numa_node = ready.numa_node;
+                placements.push_back(placed);
                 
                 std::cout << "Player " << i << " is ready to play" << std::endl;
             } catch (const NetworkError& e) {
@@ -81,18 +180,17 @@ public:
             }
         }
         
+        print_placement_map();
+        
         // Send each player information about its neighbors
         for (int i = 0; i < num_players; i++) {
             int left_id = (i + num_players - 1) % num_players;
             int right_id = (i + 1) % num_players;
+            left_ids.push_back(left_id);
+            right_ids.push_back(right_id);
             
             try {
-                NetworkUtils::send_neighbor_info(
-                    player_fds[i],
-                    left_id, right_id,
-                    player_ips[left_id], player_ips[right_id],
-                    player_ports[left_id], player_ports[right_id]
-                );
+                NetworkUtils::send<NEIGHBOR_INFO>(player_fds[i], neighbor_info(i, left_id, right_id));
             } catch (const NetworkError& e) {
                 std::cerr << e.what() << std::endl;
                 exit(EXIT_FAILURE);
@@ -100,113 +198,696 @@ public:
         }
     }
     
+    // Show where the players run, if any of them were pinned
+    void print_placement_map() const {
+        bool pinned = false;
+        for (const PlacementInfo& placed : placements) {
+            pinned = pinned || placed.cpu >= 0;
+        }
+        if (!pinned) {
+            return;
+        }
+        std::cout << "Placement map:" << std::endl;
+        for (int i = 0; i < num_players; i++) {
+            std::cout << "  Player " << i << ": " << player_ips[i];
+            if (placements[i].cpu >= 0) {
+                std::cout << " CPU " << placements[i].cpu << ", NUMA node " << placements[i].numa_node;
+            } else {
+                std::cout << " not pinned";
+            }
+            std::cout << std::endl;
+        }
+    }
+    
     void play_game() {
         // If num_hops is 0, just end the game immediately
         if (num_hops == 0) {
-            for (int fd : player_fds) {
-                try {
-                    NetworkUtils::send_game_over(fd);
-                } catch (const NetworkError& e) {
-                    std::cerr << e.what() << std::endl;
-                }
-            }
+            broadcast_game_over();
             return;
         }
         
-        // Create potato with specified number of hops
-        Potato potato(num_hops);
+        // Create potatoes with the specified number of hops, or pick up the
+        // ones from a snapshot where they left off
+        if (resume_potatoes.empty()) {
+            for (int i = 0; i < num_potatoes; i++) {
+                checkpoints.push_back(Potato(num_hops, i));
+            }
+        } else {
+            checkpoints = resume_potatoes;
+        }
+        finished.assign(num_potatoes, false);
+        launch_ns.assign(num_potatoes, 0);
+        restarts.assign(num_potatoes, std::vector<size_t>());
+        open_snapshot();
+        open_trace_file();
         
-        // Choose a random player to start with
+        // Send each potato to a random player to start with
         std::uniform_int_distribution<int> dist(0, num_players - 1);
-        int random_player = dist(rng);
+        int remaining = 0;
+        for (int i = 0; i < num_potatoes; i++) {
+            if (checkpoints[i].get_hops() == 0) {
+                finished[i] = true;
+                continue;
+            }
+            remaining++;
+            
+            int random_player = dist(rng);
+            std::cout << "Ready to start the game, sending potato to player " << random_player << std::endl;
+            launch_ns[i] = trace_now_ns();
+            restarts[i].push_back(checkpoints[i].get_trace().size());
+            
+            try {
+                NetworkUtils::send<POTATO_TRANSFER>(player_fds[random_player], checkpoints[i]);
+            } catch (const NetworkError& e) {
+                std::cerr << e.what() << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        // Wait for the potatoes to come back, healing the ring if players die
+        if (remaining > 0 && !wait_for_potatoes(remaining)) {
+            std::cerr << "Too few players left to continue, reporting last checkpoint" << std::endl;
+        }
+        commit_snapshot();
+        close_trace_file();
+        
+        // Print trace of each potato, each followed by its check
+        std::vector<uint64_t> visits(num_players, 0);
+        for (int i = 0; i < num_potatoes; i++) {
+            if (num_potatoes == 1) {
+                std::cout << "Trace of potato:" << std::endl;
+            } else {
+                std::cout << "Trace of potato " << i << ":" << std::endl;
+            }
+            std::cout << checkpoints[i].get_trace_string() << std::endl;
+            report_trace_check(i);
+            TraceCheck::count_visits(checkpoints[i].get_trace(), visits);
+        }
+        report_visits(visits);
+        
+        // Send termination signal to all players
+        broadcast_game_over();
+    }
+
+private:
+    // A player is declared dead after this many missed heartbeat periods
+    static const int HEARTBEAT_TIMEOUT_PERIODS = 4;
+    
+    static long ms_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    
+    // Transport for the link from player `from` to its right neighbor `to`.
+    // In auto and mux mode, players the ringmaster sees connecting from the
+    // same address share a host and talk over AF_UNIX; in mux mode the
+    // other links go through the link relays.
+    int link_transport(int from, int to) const {
+        if (transport != TRANSPORT_AUTO && transport != TRANSPORT_MUX) {
+            return transport;
+        }
+        if (player_ips[from] == player_ips[to]) {
+            return TRANSPORT_UNIX;
+        }
+        return transport == TRANSPORT_MUX ? TRANSPORT_MUX : TRANSPORT_TCP;
+    }
+    
+    NeighborInfo neighbor_info(int player, int left, int right) const {
+        return NeighborInfo::make(left, right,
+                                  player_ips[left], player_ips[right],
+                                  player_ports[left], player_ports[right],
+                                  link_transport(left, player), link_transport(player, right));
+    }
+    
+    // Tell every player the game is over and wait, at most teardown_ms, for
+    // each of them to acknowledge by closing its connection. All players are
+    // told at once so the teardown takes one round trip, not one per player.
+    void broadcast_game_over() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int live = std::count_if(player_fds.begin(), player_fds.end(), [](int fd) { return fd >= 0; });
         
-        std::cout << "Ready to start the game, sending potato to player " << random_player << std::endl;
+        int notified = NetworkUtils::broadcast<GAME_OVER>(player_fds, teardown_ms);
+        int remaining_ms = std::max(0, teardown_ms - static_cast<int>(ms_since(start)));
+        int closed = NetworkUtils::wait_for_close(player_fds, remaining_ms);
         
-        // Send potato to the first player
+        for (int& fd : player_fds) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        
+        double elapsed_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1000.0;
+        std::cerr << "Teardown: notified " << notified << "/" << live << " players, "
+                  << closed << " closed in " << elapsed_ms << " ms" << std::endl;
+    }
+    
+    // Create the snapshot file and record the starting state
+    void open_snapshot() {
+        if (snapshot_path.empty()) {
+            return;
+        }
         try {
-            NetworkUtils::send_potato(player_fds[random_player], potato);
-        } catch (const NetworkError& e) {
+            snapshot.create(snapshot_path, num_players, num_hops, num_potatoes);
+        } catch (const SnapshotError& e) {
+            std::cerr << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_players; i++) {
+            snapshot.save_player(i, left_ids[i], right_ids[i], true);
+        }
+        for (int i = 0; i < num_potatoes; i++) {
+            snapshot.save_potato(checkpoints[i], checkpoints[i].get_hops() == 0);
+        }
+        commit_snapshot();
+    }
+    
+    void commit_snapshot() {
+        if (snapshot.is_open()) {
+            snapshot.save_epoch(epoch);
+            snapshot.commit();
+            last_commit = std::chrono::steady_clock::now();
+        }
+    }
+    
+    // Create the binary trace file
+    void open_trace_file() {
+        if (trace_path.empty()) {
+            return;
+        }
+        try {
+            trace_writer.create(trace_path, num_players, trace_timestamps);
+        } catch (const TraceFileError& e) {
             std::cerr << e.what() << std::endl;
             exit(EXIT_FAILURE);
         }
+    }
+    
+    // Append a potato's trace to the binary trace file
+    void write_trace(const Potato& potato, bool returned) {
+        if (!trace_writer.is_open()) {
+            return;
+        }
+        try {
+            trace_writer.append(potato.get_id(), potato.get_trace(),
+                                launch_ns[potato.get_id()], returned ? trace_now_ns() : 0);
+        } catch (const TraceFileError& e) {
+            std::cerr << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // Record the potatoes that never came back, then finish the trace file
+    void close_trace_file() {
+        if (!trace_writer.is_open()) {
+            return;
+        }
+        for (int i = 0; i < num_potatoes; i++) {
+            if (!finished[i]) {
+                write_trace(checkpoints[i], false);
+            }
+        }
+        try {
+            trace_writer.close_file();
+        } catch (const TraceFileError& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    
+    // Check that every step of a potato's trace went to a ring neighbor.
+    // Steps across links made by a ring repair, and the jump to the player
+    // a potato was re-injected at, are expected; anything else is not.
+    void report_trace_check(int potato_id) {
+        const std::vector<int>& trace = checkpoints[potato_id].get_trace();
+        TraceSteps steps = TraceCheck::check_steps(trace, num_players);
+        const std::vector<size_t>& sent_at = restarts[potato_id];
         
-        // Wait for potato to come back
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
+        size_t repaired = 0;
+        std::vector<size_t> unexpected;
+        for (size_t hop : steps.others) {
+            bool in_range = trace[hop] >= 0 && trace[hop] < num_players &&
+                            (hop == 0 || (trace[hop - 1] >= 0 && trace[hop - 1] < num_players));
+            if (in_range && std::find(sent_at.begin(), sent_at.end(), hop) != sent_at.end()) {
+                repaired++;
+            } else if (in_range && hop > 0 &&
+                       repaired_links.count(std::make_pair(std::min(trace[hop - 1], trace[hop]),
+                                                           std::max(trace[hop - 1], trace[hop])))) {
+                repaired++;
+            } else {
+                unexpected.push_back(hop);
+            }
+        }
         
-        int max_fd = 0;
-        for (int fd : player_fds) {
-            FD_SET(fd, &read_fds);
-            max_fd = std::max(max_fd, fd);
+        std::cerr << "Trace check: " << trace.size() << " hops, " << steps.left << " left, "
+                  << steps.right << " right";
+        if (repaired > 0) {
+            std::cerr << ", " << repaired << " after recovery";
+        }
+        if (unexpected.empty()) {
+            std::cerr << ", all valid" << std::endl;
+            return;
+        }
+        size_t first = unexpected[0];
+        std::cerr << ", " << unexpected.size() << " invalid (first at hop " << first << ": ";
+        if (first > 0) {
+            std::cerr << trace[first - 1] << " -> ";
         }
+        std::cerr << trace[first] << ")" << std::endl;
+    }
+    
+    // Print how often each player held a potato, over all traces
+    void report_visits(const std::vector<uint64_t>& visits) {
+        uint64_t total = 0;
+        uint64_t fewest = visits.empty() ? 0 : visits[0];
+        uint64_t most = 0;
+        for (uint64_t count : visits) {
+            total += count;
+            fewest = std::min(fewest, count);
+            most = std::max(most, count);
+        }
+        std::cerr << "Visits per player (min " << fewest << ", max " << most << ", total " << total << "):";
+        for (size_t i = 0; i < visits.size(); i++) {
+            std::cerr << " " << i << ":" << visits[i];
+        }
+        std::cerr << std::endl;
+    }
+
+    // Record a newer copy of a potato
+    void update_checkpoint(const Potato& potato, bool done) {
+        checkpoints[potato.get_id()] = potato;
+        if (snapshot.is_open()) {
+            snapshot.save_potato(potato, done);
+        }
+    }
+    
+    // Drop a player from the game
+    void mark_dead(int player) {
+        std::cerr << "Player " << player << " is not responding, removing it from the ring" << std::endl;
+        close(player_fds[player]);
+        player_fds[player] = -1;
+        if (snapshot.is_open()) {
+            snapshot.save_player(player, left_ids[player], right_ids[player], false);
+        }
+    }
+    
+    // Handles messages arriving from a player during the game
+    struct PlayerHandler {
+        Ringmaster& ringmaster;
+        int& remaining;
+        int player;       // Who sent the message
+        bool dead;
+        bool lost_other;  // Another player was found dead while handling it
         
-        // Wait for potato to come back from any player
-        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
-            std::cerr << "Error in select" << std::endl;
-            exit(EXIT_FAILURE);
+        PlayerHandler(Ringmaster& owner, int& unfinished, int sender)
+            : ringmaster(owner), remaining(unfinished), player(sender), dead(false), lost_other(false) {}
+        
+        void on_message(MessageTag<POTATO_TRANSFER>, Potato& potato) {
+            if (ringmaster.is_current(potato)) {
+                ringmaster.finished[potato.get_id()] = true;
+                remaining--;
+                ringmaster.update_checkpoint(potato, true);
+                ringmaster.write_trace(potato, true);
+            }
         }
         
-        // Find the player that sent the potato back
-        Potato final_potato;
-        for (int i = 0; i < num_players; i++) {
-            if (FD_ISSET(player_fds[i], &read_fds)) {
+        void on_message(MessageTag<CHECKPOINT>, Potato& potato) {
+            if (ringmaster.is_current(potato) &&
+                potato.get_hops() < ringmaster.checkpoints[potato.get_id()].get_hops()) {
+                ringmaster.update_checkpoint(potato, false);
+            }
+        }
+        
+        // Both of the sender's links were down: this is the only copy, so
+        // keep it and pass it on right away rather than wait for a death
+        void on_message(MessageTag<ORPHANED_POTATO>, Potato& potato) {
+            if (ringmaster.is_current(potato)) {
+                ringmaster.update_checkpoint(potato, false);
+                lost_other = !ringmaster.reinject(potato.get_id(), player);
+            }
+        }
+        
+        void on_message(MessageTag<HEARTBEAT>, EmptyMessage&) {}
+        
+        // Connection closed (reported as GAME_OVER) or garbage
+        template <MessageType Type, typename Payload>
+        void on_message(MessageTag<Type>, Payload&) {
+            dead = true;
+        }
+    };
+    
+    // Whether a potato is an unfinished one from the current epoch, rather
+    // than a stale copy from before a recovery
+    bool is_current(const Potato& potato) const {
+        int potato_id = potato.get_id();
+        return potato_id >= 0 && potato_id < num_potatoes && !finished[potato_id] &&
+               potato.get_epoch() == epoch;
+    }
+    
+    // Serve player messages until every current-epoch potato comes back.
+    // Returns false if the ring could not be repaired; unfinished potatoes
+    // are then left at their last checkpoint.
+    bool wait_for_potatoes(int remaining) {
+        std::vector<std::chrono::steady_clock::time_point> last_seen(
+            num_players, std::chrono::steady_clock::now());
+        int timeout_ms = HEARTBEAT_TIMEOUT_PERIODS * heartbeat_ms;
+        
+        // poll() rather than select(), so player fds past FD_SETSIZE work
+        std::vector<struct pollfd> ready;
+        std::vector<int> ready_players;  // Player each entry of ready belongs to
+        
+        while (remaining > 0) {
+            ready.clear();
+            ready_players.clear();
+            for (int i = 0; i < num_players; i++) {
+                if (player_fds[i] >= 0) {
+                    struct pollfd entry = {player_fds[i], POLLIN, 0};
+                    ready.push_back(entry);
+                    ready_players.push_back(i);
+                }
+            }
+            
+            if (poll(ready.data(), ready.size(), heartbeat_ms > 0 ? heartbeat_ms : -1) < 0) {
+                std::cerr << "Error in poll" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            
+            bool died = false;
+            for (size_t k = 0; k < ready.size(); k++) {
+                int i = ready_players[k];
+                if (player_fds[i] < 0 || ready[k].revents == 0) {
+                    continue;
+                }
+                
+                std::vector<char> data;
+                PlayerHandler handler(*this, remaining, i);
                 try {
-                    final_potato = NetworkUtils::receive_potato(player_fds[i]);
-                    break;
+                    MessageHeader header = NetworkUtils::receive_message(player_fds[i], data);
+                    if (!dispatch_message(handler, header, data)) {
+                        handler.dead = true;
+                    }
                 } catch (const NetworkError& e) {
-                    std::cerr << e.what() << std::endl;
-                    exit(EXIT_FAILURE);
+                    handler.dead = true;
+                }
+                last_seen[i] = std::chrono::steady_clock::now();
+                
+                if (handler.dead) {
+                    mark_dead(i);
+                    died = true;
+                }
+                died = died || handler.lost_other;
+            }
+            
+            if (heartbeat_ms > 0) {
+                for (int i = 0; i < num_players; i++) {
+                    if (player_fds[i] >= 0 && ms_since(last_seen[i]) > timeout_ms) {
+                        mark_dead(i);
+                        died = true;
+                    }
                 }
             }
+            
+            if (died && remaining > 0 && !repair_ring()) {
+                return false;
+            }
+            
+            if (snapshot.is_open() && ms_since(last_commit) >= snapshot_ms) {
+                commit_snapshot();
+            }
         }
-        
-        // Print trace of potato
-        std::cout << "Trace of potato:" << std::endl;
-        std::cout << final_potato.get_trace_string() << std::endl;
-        
-        // Send termination signal to all players
-        for (int fd : player_fds) {
-            try {
-                NetworkUtils::send_game_over(fd);
-            } catch (const NetworkError& e) {
-                std::cerr << e.what() << std::endl;
+        return true;
+    }
+    
+    // Send a potato on from its checkpoint to a random live player other
+    // than `from` (unless it is the only one). Returns false if that player
+    // turned out to be dead; the ring must then be repaired, which
+    // re-injects the potato anyway.
+    bool reinject(int potato_id, int from) {
+        std::vector<int> live;
+        for (int i = 0; i < num_players; i++) {
+            if (player_fds[i] >= 0 && i != from) {
+                live.push_back(i);
             }
         }
+        int target = live.empty() ? from : live[std::uniform_int_distribution<int>(0, live.size() - 1)(rng)];
+        restarts[potato_id].push_back(checkpoints[potato_id].get_trace().size());
+        std::cerr << "Re-injecting orphaned potato " << potato_id << " with "
+                  << checkpoints[potato_id].get_hops() << " hops left at player " << target << std::endl;
+        try {
+            NetworkUtils::send<POTATO_TRANSFER>(player_fds[target], checkpoints[potato_id]);
+        } catch (const NetworkError& e) {
+            mark_dead(target);
+            return false;
+        }
+        return true;
+    }
+    
+    // Reconnect the ring around dead players and re-inject the unfinished
+    // potatoes from their last checkpoints under a new epoch, so any
+    // surviving copy of an old potato is ignored. Returns false if fewer than
+    // two players are left.
+    bool repair_ring() {
+        while (true) {
+            std::vector<int> live;
+            for (int i = 0; i < num_players; i++) {
+                if (player_fds[i] >= 0) {
+                    live.push_back(i);
+                }
+            }
+            if (live.size() < 2) {
+                return false;
+            }
+            
+            // Tell every player whose neighbors changed about its new neighbors
+            int first_repaired = -1;
+            int failed = -1;
+            for (size_t k = 0; k < live.size() && failed < 0; k++) {
+                int player = live[k];
+                int left = live[(k + live.size() - 1) % live.size()];
+                int right = live[(k + 1) % live.size()];
+                if (left == left_ids[player] && right == right_ids[player]) {
+                    continue;
+                }
+                
+                try {
+                    NetworkUtils::send<NEIGHBOR_INFO>(player_fds[player], neighbor_info(player, left, right));
+                    left_ids[player] = left;
+                    right_ids[player] = right;
+                    repaired_links.insert(std::make_pair(std::min(player, left), std::max(player, left)));
+                    repaired_links.insert(std::make_pair(std::min(player, right), std::max(player, right)));
+                    if (snapshot.is_open()) {
+                        snapshot.save_player(player, left, right, true);
+                    }
+                    if (first_repaired < 0) {
+                        first_repaired = player;
+                    }
+                } catch (const NetworkError& e) {
+                    failed = player;
+                }
+            }
+            if (failed >= 0) {
+                mark_dead(failed);
+                continue;
+            }
+            
+            // Re-inject the unfinished potatoes from their last checkpoints
+            epoch++;
+            int target = first_repaired >= 0 ? first_repaired : live[0];
+            bool sent = true;
+            for (int i = 0; i < num_potatoes && sent; i++) {
+                if (finished[i]) {
+                    continue;
+                }
+                checkpoints[i].set_epoch(epoch);
+                restarts[i].push_back(checkpoints[i].get_trace().size());
+                std::cerr << "Recovering potato " << i << " with " << checkpoints[i].get_hops()
+                          << " hops left at player " << target << std::endl;
+                try {
+                    NetworkUtils::send<POTATO_TRANSFER>(player_fds[target], checkpoints[i]);
+                } catch (const NetworkError& e) {
+                    mark_dead(target);
+                    sent = false;
+                }
+            }
+            if (!sent) {
+                continue;
+            }
+            commit_snapshot();
+            return true;
+        }
     }
 };
 
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <port_num> <num_players> <num_hops>"
+              << " [--potatoes N] [--heartbeat-ms N] [--checkpoint-every N]"
+              << " [--snapshot FILE] [--snapshot-ms N] [--resume FILE]"
+              << " [--trace-file FILE] [--trace-timestamps] [--teardown-ms N]"
+              << " [--transport auto|tcp|unix|udp|mux] [--relay-port N]"
+              << " [--policy random|power-of-two|least-recent]"
+              << " [--cpus LIST] [--numa-node N]" << std::endl;
+    std::cerr << "  heartbeats and checkpoints are off unless --heartbeat-ms or --checkpoint-every is given;"
+              << " without them a dead player is noticed only when its socket closes and its potatoes"
+              << " restart from launch" << std::endl;
+    std::cerr << "  power-of-two sees what is queued towards a neighbor only on unix and udp links;"
+              << " over tcp and mux it goes by the backlog neighbors report" << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     // Check command line arguments
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <port_num> <num_players> <num_hops>" << std::endl;
+    if (argc < 4) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
     
     // Parse arguments
-    int port = std::atoi(argv[1]);
-    int num_players = std::atoi(argv[2]);
-    int num_hops = std::atoi(argv[3]);
+    RingmasterConfig config;
+    config.port = std::atoi(argv[1]);
+    config.num_players = std::atoi(argv[2]);
+    config.num_hops = std::atoi(argv[3]);
+    std::string resume_path;
+    
+    // Parse optional flags
+    for (int i = 4; i < argc; i++) {
+        std::string flag(argv[i]);
+        if (flag == "--potatoes" && i + 1 < argc) {
+            config.num_potatoes = std::atoi(argv[++i]);
+        } else if (flag == "--heartbeat-ms" && i + 1 < argc) {
+            config.heartbeat_ms = std::atoi(argv[++i]);
+        } else if (flag == "--checkpoint-every" && i + 1 < argc) {
+            config.checkpoint_interval = std::atoi(argv[++i]);
+        } else if (flag == "--snapshot" && i + 1 < argc) {
+            config.snapshot_path = argv[++i];
+        } else if (flag == "--snapshot-ms" && i + 1 < argc) {
+            config.snapshot_ms = std::atoi(argv[++i]);
+        } else if (flag == "--resume" && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (flag == "--trace-file" && i + 1 < argc) {
+            config.trace_path = argv[++i];
+        } else if (flag == "--trace-timestamps") {
+            config.trace_timestamps = true;
+        } else if (flag == "--teardown-ms" && i + 1 < argc) {
+            config.teardown_ms = std::atoi(argv[++i]);
+        } else if (flag == "--transport" && i + 1 < argc) {
+            std::string name(argv[++i]);
+            if (name == "auto") {
+                config.transport = TRANSPORT_AUTO;
+            } else if (name == "tcp") {
+                config.transport = TRANSPORT_TCP;
+            } else if (name == "unix") {
+                config.transport = TRANSPORT_UNIX;
+            } else if (name == "udp") {
+                config.transport = TRANSPORT_UDP;
+            } else if (name == "mux") {
+                config.transport = TRANSPORT_MUX;
+            } else {
+                std::cerr << "Error: unknown transport " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (flag == "--relay-port" && i + 1 < argc) {
+            config.relay_port = std::atoi(argv[++i]);
+        } else if (flag == "--cpus" && i + 1 < argc) {
+            config.cpu_list = argv[++i];
+        } else if (flag == "--numa-node" && i + 1 < argc) {
+            if (!CpuPlacement::parse_numa_node(argv[++i], &config.numa_node)) {
+                std::cerr << "Error: bad NUMA node " << argv[i] << std::endl;
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (flag == "--policy" && i + 1 < argc) {
+            if (!ForwardingPolicy::parse_kind(argv[++i], &config.forwarding_policy)) {
+                std::cerr << "Error: unknown forwarding policy " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else {
+            std::cerr << "Error: unknown option " << flag << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
     
     // Validate arguments
-    if (port < 1 || port > 65535) {
+    if (config.port < 1 || config.port > 65535) {
         std::cerr << "Error: port must be between 1 and 65535" << std::endl;
         return EXIT_FAILURE;
     }
     
-    if (num_players < 2) {
+    if (config.num_players < 2) {
         std::cerr << "Error: number of players must be at least 2" << std::endl;
         return EXIT_FAILURE;
     }
     
-    if (num_hops < 0 || num_hops > 512) {
+    if (config.num_hops < 0 || config.num_hops > 512) {
         std::cerr << "Error: hops must be between 0 and 512" << std::endl;
         return EXIT_FAILURE;
     }
     
+    if (config.num_potatoes < 1) {
+        std::cerr << "Error: number of potatoes must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    if (config.transport == TRANSPORT_MUX && (config.relay_port < 1 || config.relay_port > 65535)) {
+        std::cerr << "Error: the mux transport needs --relay-port between 1 and 65535" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    if (config.forwarding_policy == POLICY_POWER_OF_TWO &&
+        (config.transport == TRANSPORT_TCP || config.transport == TRANSPORT_MUX)) {
+        std::cerr << "Warning: power-of-two cannot see what is queued towards a neighbor over this"
+                  << " transport and will go by the backlog neighbors report" << std::endl;
+    }
+    
+    if (config.heartbeat_ms < 0 || config.checkpoint_interval < 0 || config.snapshot_ms < 0 ||
+        config.teardown_ms < 0) {
+        std::cerr << "Error: heartbeat, checkpoint, snapshot and teardown intervals must not be negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    // Load the snapshot to resume from before anything can overwrite it
+    SnapshotState resume_state;
+    if (!resume_path.empty()) {
+        try {
+            resume_state = GameSnapshot::load(resume_path);
+        } catch (const SnapshotError& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (resume_state.num_players != config.num_players ||
+            resume_state.num_hops != config.num_hops) {
+            std::cerr << "Error: snapshot was taken with " << resume_state.num_players
+                      << " players and " << resume_state.num_hops << " hops" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    // Move to the requested CPUs before any game state is allocated
+    if (!config.cpu_list.empty() || config.numa_node >= 0) {
+        try {
+            CpuPlacement placement(config.cpu_list, config.numa_node);
+            placement.place_all();
+            std::cout << "Ringmaster pinned to CPUs " << placement.describe();
+            if (config.numa_node >= 0) {
+                std::cout << ", NUMA node " << config.numa_node;
+            }
+            std::cout << std::endl;
+        } catch (const PlacementError& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
     // Create ringmaster and run the game
-    Ringmaster ringmaster(port, num_players, num_hops);
+    Ringmaster ringmaster(config);
+    if (!resume_path.empty()) {
+        try {
+            ringmaster.resume_from(resume_state);
+        } catch (const SnapshotError& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
     ringmaster.setup_game();
     ringmaster.play_game();
     
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,555 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <memory>
+
+#include "potato.h"
+#include "forwarding_policy.h"
+#include "potato_hop.h"
+
+// Plays the game in a single process with no sockets: the ringmaster and the
+// players' hop logic run against a virtual network on simulated time, so
+// rings far larger than the processes one machine can hold can be studied.
+// Each hop is decided by PotatoHop, as in the player.
+//
+// Measured on one core of a small VM with -O2 (a dependent load from DRAM
+// takes about 290 ns there): 15-19M hops/s with 100 potatoes in flight on
+// 1M players, 4-6M with 10k potatoes and 3.4M with 100k. With many potatoes
+// each hop needs the potato, its trace, the player and its links from DRAM;
+// those are prefetched a few events ahead, but memory bandwidth and latency
+// still set the pace.
+
+// Settings for one simulated game
+struct SimulatorConfig {
+    int num_players;
+    int num_hops;
+    int num_potatoes;          // Potatoes in flight at once
+    int forwarding_policy;     // ForwardingPolicyKind every player uses
+    int checkpoint_interval;   // Checkpoint every N hops, as the ringmaster asks (0 = off, its default)
+    double hop_us;             // Time a player spends handling one potato
+    int players_per_host;      // Consecutive ring positions per host (0 = one host)
+    double local_latency_us;   // One-way latency between players on the same host
+    double local_mbps;         // Bandwidth between players on the same host (0 = unlimited)
+    double remote_latency_us;  // One-way latency between hosts
+    double remote_mbps;        // Bandwidth between hosts (0 = unlimited)
+    unsigned seed;
+    bool print_traces;
+
+    SimulatorConfig()
+        : num_players(0), num_hops(0), num_potatoes(1), forwarding_policy(POLICY_RANDOM),
+          checkpoint_interval(0), hop_us(5), players_per_host(0), local_latency_us(20), local_mbps(0),
+          remote_latency_us(100), remote_mbps(1000), seed(1), print_traces(false) {}
+};
+
+// Stand-in for the sockets. Every directed link between ring neighbors has
+// a latency and a bandwidth, and a message leaves only once the messages
+// queued on the same link before it have been transmitted. The ringmaster
+// counts as a host of its own.
+class VirtualNetwork {
+private:
+    struct LinkClass {
+        uint64_t latency_ns;
+        double ns_per_byte;  // 0 = unlimited bandwidth
+    };
+
+    // Potatoes a link has carried that the neighbor has not started on.
+    // A player's SIOCOUTQ on a unix or UDP link counts the same potatoes:
+    // those in flight and those the neighbor has received but not read.
+    struct Unread {
+        int count;
+        size_t head;                  // First entry of starts still to come
+        std::vector<uint64_t> starts; // When the neighbor starts on those that have arrived, in order
+
+        Unread() : count(0), head(0) {}
+    };
+
+    LinkClass local;
+    LinkClass remote;
+    int players_per_host;
+    int num_players;
+    std::vector<uint64_t> link_free;  // When each player's link on each side is next idle
+    std::vector<Unread> unread;       // Per link, kept only for load-aware policies
+
+    static LinkClass make_class(double latency_us, double mbps) {
+        LinkClass link;
+        link.latency_ns = static_cast<uint64_t>(latency_us * 1000);
+        link.ns_per_byte = mbps > 0 ? 8000.0 / mbps : 0;
+        return link;
+    }
+
+    const LinkClass& link_class(int from, int to) const {
+        if (players_per_host <= 0 || from / players_per_host == to / players_per_host) {
+            return local;
+        }
+        return remote;
+    }
+
+    // Potatoes sent on a link that the neighbor has not started on by now,
+    // without letting go of the ones it has
+    int unread_at(int from_link, uint64_t now) const {
+        const Unread& pending = unread[from_link];
+        std::vector<uint64_t>::const_iterator first = pending.starts.begin() + pending.head;
+        return pending.count - static_cast<int>(std::upper_bound(first, pending.starts.end(), now) - first);
+    }
+
+public:
+    VirtualNetwork(const SimulatorConfig& config, bool count_unread)
+        : local(make_class(config.local_latency_us, config.local_mbps)),
+          remote(make_class(config.remote_latency_us, config.remote_mbps)),
+          players_per_host(config.players_per_host), num_players(config.num_players),
+          link_free(2 * static_cast<size_t>(config.num_players), 0),
+          unread(count_unread ? 2 * static_cast<size_t>(config.num_players) : 0) {}
+
+    // Index of a player's link on one side
+    static int link(int from, Direction side) {
+        return 2 * from + side;
+    }
+
+    int neighbor(int player, Direction side) const {
+        if (side == DIRECTION_LEFT) {
+            return player == 0 ? num_players - 1 : player - 1;
+        }
+        return player == num_players - 1 ? 0 : player + 1;
+    }
+
+    // Send bytes from player to its neighbor on side at time now; returns
+    // when the message arrives
+    uint64_t send(int from, Direction side, int bytes, uint64_t now) {
+        const LinkClass& link_type = link_class(from, neighbor(from, side));
+        uint64_t& free = link_free[link(from, side)];
+        uint64_t start = std::max(now, free);
+        free = start + static_cast<uint64_t>(bytes * link_type.ns_per_byte);
+        if (!unread.empty()) {
+            unread[link(from, side)].count++;
+        }
+        return free + link_type.latency_ns;
+    }
+
+    // A potato that came over link (-1 for the ringmaster) will be started
+    // on at time start. Potatoes on one link arrive, and are started on, in
+    // the order they were sent.
+    void started(int from_link, uint64_t start) {
+        if (from_link >= 0 && !unread.empty()) {
+            unread[from_link].starts.push_back(start);
+        }
+    }
+
+    // Potatoes sent on a player's link that the neighbor has not started on
+    // by time now. A player asks with non-decreasing times.
+    int unread_count(int from, Direction side, uint64_t now) {
+        Unread& pending = unread[link(from, side)];
+        while (pending.head < pending.starts.size() && pending.starts[pending.head] <= now) {
+            pending.head++;
+            pending.count--;
+        }
+        if (pending.head == pending.starts.size()) {
+            pending.starts.clear();
+            pending.head = 0;
+        }
+        return pending.count;
+    }
+
+    // Potatoes sent to a player that it has not started on by time now,
+    // what its SIOCINQ on the two links would show
+    int waiting(int player, uint64_t now) const {
+        return unread_at(link(neighbor(player, DIRECTION_LEFT), DIRECTION_RIGHT), now) +
+               unread_at(link(neighbor(player, DIRECTION_RIGHT), DIRECTION_LEFT), now);
+    }
+
+    // Start loading a player's links into cache. Always inlined: GCC takes
+    // a function that only prefetches for one without side effects and
+    // drops the call.
+    __attribute__((always_inline)) void prefetch(int from) const {
+        __builtin_prefetch(&link_free[link(from, DIRECTION_LEFT)]);
+    }
+
+    // One-way time between the ringmaster and any player
+    uint64_t master_latency(int bytes) const {
+        return remote.latency_ns + static_cast<uint64_t>(bytes * remote.ns_per_byte);
+    }
+};
+
+// A potato arriving at a player
+struct Event {
+    uint64_t time;
+    uint64_t order;  // Breaks ties in scheduling order, for repeatable runs
+    int potato;
+    int player;
+    int link;        // Sender's link the potato came over, -1 from the ringmaster
+
+    bool before(const Event& other) const {
+        return time != other.time ? time < other.time : order < other.order;
+    }
+};
+
+// Priority queue of events, as a radix heap. Handling an event only ever
+// schedules later ones, so times taken out never decrease, and each event is
+// filed by the highest bit in which its time differs from the last time taken
+// out. Bucket 0 holds the events at exactly that time, in scheduling order.
+// An event moves to a lower bucket only a few times, each a sequential
+// append, where a binary heap the size of the potato count would cost a
+// cache-missing sift on every hop.
+class EventQueue {
+private:
+    static const int BUCKETS = 65;
+
+    std::vector<Event> buckets[BUCKETS];
+    size_t head;      // Next event of bucket 0 to take out
+    uint64_t last;    // Time of the last event taken out
+    size_t count;
+
+    int bucket_of(uint64_t time) const {
+        return time == last ? 0 : 64 - __builtin_clzll(time ^ last);
+    }
+
+    static bool earlier_order(const Event& a, const Event& b) {
+        return a.order < b.order;
+    }
+
+    // Move the earliest events into bucket 0: advance to the earliest time
+    // in the lowest non-empty bucket and refile that bucket's events, all of
+    // which land in lower buckets
+    void refill() {
+        buckets[0].clear();
+        head = 0;
+        int source = 1;
+        while (buckets[source].empty()) {
+            source++;
+        }
+        std::vector<Event>& events = buckets[source];
+        last = events[0].time;
+        for (const Event& event : events) {
+            last = std::min(last, event.time);
+        }
+        for (const Event& event : events) {
+            buckets[bucket_of(event.time)].push_back(event);
+        }
+        events.clear();
+        if (!std::is_sorted(buckets[0].begin(), buckets[0].end(), earlier_order)) {
+            std::sort(buckets[0].begin(), buckets[0].end(), earlier_order);
+        }
+    }
+
+public:
+    EventQueue() : head(0), last(0), count(0) {}
+
+    bool empty() const { return count == 0; }
+
+    const Event& top() {
+        if (head == buckets[0].size()) {
+            refill();
+        }
+        return buckets[0][head];
+    }
+
+    // The event that many places after the top, if it is already known to
+    // be next in line; NULL otherwise
+    const Event* peek(size_t ahead) const {
+        return head + ahead < buckets[0].size() ? &buckets[0][head + ahead] : NULL;
+    }
+
+    // Events must not be earlier than the last one taken out
+    void push(const Event& event) {
+        buckets[bucket_of(event.time)].push_back(event);
+        count++;
+    }
+
+    void pop() {
+        top();
+        head++;
+        count--;
+        if (head == buckets[0].size()) {
+            buckets[0].clear();
+            head = 0;
+        }
+    }
+
+    // Remove the earliest event and add event in its place
+    void replace_top(const Event& event) {
+        pop();
+        push(event);
+    }
+};
+
+class Simulator {
+private:
+    static const size_t PREFETCH_DISTANCE = 16;  // Events ahead to prefetch for
+
+    SimulatorConfig config;
+    std::unique_ptr<ForwardingPolicy> policy;
+    bool load_aware;    // Whether the policy looks at load, so hints are worth noting
+    VirtualNetwork network;
+    std::mt19937 rng;
+    EventQueue events;
+    uint64_t next_order;
+    uint64_t hop_ns;
+    long checkpoints;   // Checkpoint copies sent to the ringmaster; counted, not timed
+
+    // Per-player state, as the Player class keeps it. One struct per player
+    // keeps a hop down to a cache line or two on rings far larger than cache.
+    struct PlayerState {
+        uint64_t busy_until;     // When the player finishes its queued potatoes
+        NeighborLoad left_load;
+        NeighborLoad right_load;
+        long forwarded;
+        long visits;
+
+        PlayerState() : busy_until(0), forwarded(0), visits(0) {}
+    };
+
+    std::vector<PlayerState> players;
+
+    std::vector<Potato> potatoes;
+    std::vector<uint64_t> finish_ns;   // When each potato got back to the ringmaster
+
+    Event make_event(uint64_t time, int potato, int player, int link) {
+        Event event;
+        event.time = time;
+        event.order = next_order++;
+        event.potato = potato;
+        event.player = player;
+        event.link = link;
+        return event;
+    }
+
+    static int message_size(const Potato& potato) {
+        return MessageHeader::HEADER_SIZE + MessageCodec<Potato>::size(potato);
+    }
+
+    // Player::handle_potato, with the player's time and links simulated.
+    // Returns false when the potato went back to the ringmaster, otherwise
+    // sets next to its arrival at the chosen neighbor.
+    bool handle_potato(const Event& event, Event* next) {
+        int id = event.player;
+        PlayerState& player = players[id];
+        Potato& potato = potatoes[event.potato];
+        if (load_aware) {
+            PotatoHop::note_load_hint(potato, network.neighbor(id, DIRECTION_LEFT),
+                                      network.neighbor(id, DIRECTION_RIGHT), player.left_load, player.right_load);
+        }
+
+        // The player handles potatoes one at a time, in arrival order
+        uint64_t start = std::max(event.time, player.busy_until);
+        uint64_t done = start + hop_ns;
+        player.busy_until = done;
+        network.started(event.link, start);
+        player.visits++;
+
+        PotatoHop hop = PotatoHop::take(potato, id, config.checkpoint_interval, *policy,
+                                        player.left_load, player.right_load, rng,
+                                        [&](Potato& passed) {
+            player.left_load.outbound = network.unread_count(id, DIRECTION_LEFT, done);
+            player.right_load.outbound = network.unread_count(id, DIRECTION_RIGHT, done);
+            passed.set_load_hint(network.waiting(id, done));
+        });
+
+        if (hop.finished) {
+            finish_ns[event.potato] = done + network.master_latency(message_size(potato));
+            return false;
+        }
+        if (hop.checkpoint) {
+            checkpoints++;
+        }
+
+        (hop.side == DIRECTION_LEFT ? player.left_load : player.right_load).note_sent(player.forwarded++);
+        uint64_t arrival = network.send(id, hop.side, message_size(potato), done);
+        *next = make_event(arrival, event.potato, network.neighbor(id, hop.side), VirtualNetwork::link(id, hop.side));
+        return true;
+    }
+
+    // Start loading what upcoming hops touch, which on large rings is all
+    // cache misses: the potato a little further ahead, then its trace, its
+    // next player and that player's links once the potato is in cache.
+    // Always inlined, for the reason given at VirtualNetwork::prefetch.
+    __attribute__((always_inline)) void prefetch_ahead() {
+        const Event* later = events.peek(4 * PREFETCH_DISTANCE);
+        if (later) {
+            __builtin_prefetch(&potatoes[later->potato]);
+        }
+        const Event* soon = events.peek(PREFETCH_DISTANCE);
+        if (soon) {
+            const std::vector<int>& trace = potatoes[soon->potato].get_trace();
+            __builtin_prefetch(trace.data() + trace.size());
+            const char* player = reinterpret_cast<const char*>(&players[soon->player]);
+            __builtin_prefetch(player);
+            __builtin_prefetch(player + sizeof(PlayerState) - 1);
+            network.prefetch(soon->player);
+        }
+    }
+
+    static double percentile(std::vector<uint64_t> values, double fraction) {
+        if (values.empty()) {
+            return 0;
+        }
+        size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+public:
+    Simulator(const SimulatorConfig& settings)
+        : config(settings), policy(ForwardingPolicy::create(settings.forwarding_policy)),
+          load_aware(policy->uses_load()), network(settings, load_aware),
+          rng(settings.seed), next_order(0), hop_ns(static_cast<uint64_t>(settings.hop_us * 1000)), checkpoints(0),
+          players(settings.num_players), finish_ns(settings.num_potatoes, 0) {}
+
+    void run() {
+        std::cout << "Potato Simulator" << std::endl;
+        std::cout << "Players = " << config.num_players << std::endl;
+        std::cout << "Hops = " << config.num_hops << std::endl;
+
+        // Like the ringmaster: each potato starts at a random player
+        std::uniform_int_distribution<int> dist(0, config.num_players - 1);
+        potatoes.reserve(config.num_potatoes);
+        for (int i = 0; i < config.num_potatoes; i++) {
+            potatoes.push_back(Potato(config.num_hops, i));
+            potatoes.back().reserve_trace(config.num_hops);
+            if (config.num_hops > 0) {
+                events.push(make_event(network.master_latency(message_size(potatoes[i])), i, dist(rng), -1));
+            }
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long hops = 0;
+        while (!events.empty()) {
+            prefetch_ahead();
+            Event next;
+            if (handle_potato(events.top(), &next)) {
+                events.replace_top(next);
+            } else {
+                events.pop();
+            }
+            hops++;
+        }
+        double elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (config.print_traces) {
+            for (const Potato& potato : potatoes) {
+                std::cout << "Trace of potato " << potato.get_id() << ":" << std::endl;
+                std::cout << potato.get_trace_string() << std::endl;
+            }
+        }
+        report(hops, elapsed_ns);
+    }
+
+private:
+    void report(long hops, double elapsed_ns) {
+        double total_ms = *std::max_element(finish_ns.begin(), finish_ns.end()) / 1e6;
+        std::cout << "Simulated game time: " << total_ms << " ms" << std::endl;
+        if (config.num_hops > 0) {
+            double sum = 0;
+            for (uint64_t ns : finish_ns) {
+                sum += ns;
+            }
+            std::cout << "Potato time: mean " << sum / finish_ns.size() / 1e6
+                      << " ms, p50 " << percentile(finish_ns, 0.5) / 1e6
+                      << " ms, p99 " << percentile(finish_ns, 0.99) / 1e6
+                      << " ms, max " << total_ms << " ms" << std::endl;
+        }
+
+        int fewest = 0;
+        int most = 0;
+        for (int i = 1; i < config.num_players; i++) {
+            if (players[i].visits < players[fewest].visits) {
+                fewest = i;
+            }
+            if (players[i].visits > players[most].visits) {
+                most = i;
+            }
+        }
+        std::cout << "Visits per player: min " << players[fewest].visits << " (player " << fewest
+                  << "), max " << players[most].visits << " (player " << most
+                  << "), mean " << static_cast<double>(hops) / config.num_players << std::endl;
+
+        std::cout << "Checkpoints sent: " << checkpoints << std::endl;
+
+        std::cout << "Simulated " << hops << " hops in " << elapsed_ns / 1e6 << " ms";
+        if (hops > 0) {
+            std::cout << " (" << hops / (elapsed_ns / 1e9) / 1e6 << " M hops/s)";
+        }
+        std::cout << std::endl;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // Check command line arguments
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <num_players> <num_hops>"
+                  << " [--potatoes N] [--policy random|power-of-two|least-recent] [--checkpoint-every N] [--hop-us US]"
+                  << " [--players-per-host N] [--latency-us US] [--mbps N]"
+                  << " [--remote-latency-us US] [--remote-mbps N] [--seed N] [--traces]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Parse arguments
+    SimulatorConfig config;
+    config.num_players = std::atoi(argv[1]);
+    config.num_hops = std::atoi(argv[2]);
+
+    // Parse optional flags
+    for (int i = 3; i < argc; i++) {
+        std::string flag(argv[i]);
+        if (flag == "--potatoes" && i + 1 < argc) {
+            config.num_potatoes = std::atoi(argv[++i]);
+        } else if (flag == "--policy" && i + 1 < argc) {
+            if (!ForwardingPolicy::parse_kind(argv[++i], &config.forwarding_policy)) {
+                std::cerr << "Error: unknown forwarding policy " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (flag == "--checkpoint-every" && i + 1 < argc) {
+            config.checkpoint_interval = std::atoi(argv[++i]);
+        } else if (flag == "--hop-us" && i + 1 < argc) {
+            config.hop_us = std::atof(argv[++i]);
+        } else if (flag == "--players-per-host" && i + 1 < argc) {
+            config.players_per_host = std::atoi(argv[++i]);
+        } else if (flag == "--latency-us" && i + 1 < argc) {
+            config.local_latency_us = std::atof(argv[++i]);
+        } else if (flag == "--mbps" && i + 1 < argc) {
+            config.local_mbps = std::atof(argv[++i]);
+        } else if (flag == "--remote-latency-us" && i + 1 < argc) {
+            config.remote_latency_us = std::atof(argv[++i]);
+        } else if (flag == "--remote-mbps" && i + 1 < argc) {
+            config.remote_mbps = std::atof(argv[++i]);
+        } else if (flag == "--seed" && i + 1 < argc) {
+            config.seed = static_cast<unsigned>(std::strtoul(argv[++i], NULL, 10));
+        } else if (flag == "--traces") {
+            config.print_traces = true;
+        } else {
+            std::cerr << "Error: unknown option " << flag << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Validate arguments; unlike the real game the hop count is not capped
+    if (config.num_players < 2) {
+        std::cerr << "Error: number of players must be at least 2" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (config.num_hops < 0) {
+        std::cerr << "Error: number of hops must be at least 0" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (config.num_potatoes < 1) {
+        std::cerr << "Error: number of potatoes must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (config.checkpoint_interval < 0) {
+        std::cerr << "Error: checkpoint interval must not be negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (config.hop_us < 0 || config.players_per_host < 0 || config.local_latency_us < 0 ||
+        config.local_mbps < 0 || config.remote_latency_us < 0 || config.remote_mbps < 0) {
+        std::cerr << "Error: times, bandwidths and host sizes must not be negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Simulator simulator(config);
+    simulator.run();
+    return EXIT_SUCCESS;
+}
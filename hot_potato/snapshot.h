@@ -0,0 +1,318 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "potato.h"
+
+// Exception class for snapshot file operations
+class SnapshotError : public std::runtime_error {
+public:
+    SnapshotError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// On-disk layout of a game snapshot:
+//   SnapshotHeader | SnapshotPlayer[2 * num_players] | SnapshotPotato[2 * num_potatoes]
+// Every record has a fixed size, so the ringmaster updates the mapping in
+// place as checkpoints arrive and never has to rewrite the file. Each record
+// is kept twice: an update overwrites the older copy, whose sequence is odd
+// while the write is in progress, so a crash mid-update leaves the other
+// copy whole.
+struct SnapshotHeader {
+    char magic[8];          // "HPSNAP2"
+    uint32_t num_players;
+    uint32_t num_hops;      // Hops each potato started with
+    uint32_t num_potatoes;
+    uint32_t max_hops;      // Trace capacity of each potato record
+    uint32_t epoch;         // Ring epoch at the last commit
+    uint32_t reserved;
+    uint64_t sequence;      // Bumped on every commit
+    uint64_t commit_ns;     // Wall-clock time of the last commit
+};
+
+// Ring topology as last announced to one player
+struct SnapshotPlayer {
+    uint32_t sequence;      // Odd while being written, 0 if never written
+    int32_t left_id;
+    int32_t right_id;
+    int32_t alive;
+};
+
+// Last known state of one potato
+struct SnapshotPotato {
+    uint32_t sequence;      // Odd while being written, 0 if never written
+    int32_t id;
+    int32_t remaining_hops;
+    int32_t epoch;
+    int32_t finished;       // Non-zero once the potato is back at the ringmaster
+    int32_t trace_length;
+    int32_t trace[MAX_HOPS];
+};
+
+// Game state recovered from a snapshot file
+struct SnapshotState {
+    int num_players;
+    int num_hops;
+    int epoch;
+    uint64_t sequence;
+    std::vector<SnapshotPlayer> players;
+    std::vector<Potato> potatoes;
+    std::vector<bool> finished;
+};
+
+// Memory-mapped game snapshot written by the ringmaster
+class GameSnapshot {
+private:
+    int fd;
+    char* map;
+    size_t map_size;
+    int num_players;
+    int num_potatoes;
+    
+    static const char* magic() { return "HPSNAP2"; }
+    
+    static size_t file_size(size_t players, size_t potatoes) {
+        return sizeof(SnapshotHeader) + 2 * players * sizeof(SnapshotPlayer) +
+               2 * potatoes * sizeof(SnapshotPotato);
+    }
+    
+    SnapshotHeader* header() const { return reinterpret_cast<SnapshotHeader*>(map); }
+    
+    SnapshotPlayer* players() const {
+        return reinterpret_cast<SnapshotPlayer*>(map + sizeof(SnapshotHeader));
+    }
+    
+    SnapshotPotato* potatoes() const {
+        return reinterpret_cast<SnapshotPotato*>(
+            map + sizeof(SnapshotHeader) + 2 * num_players * sizeof(SnapshotPlayer));
+    }
+    
+    // Mark the older of a record's two copies as being overwritten
+    template <typename Record>
+    static Record& begin_write(Record* copies) {
+        Record& target = copies[0].sequence <= copies[1].sequence ? copies[0] : copies[1];
+        uint32_t next = std::max(copies[0].sequence, copies[1].sequence) + 1;
+        __atomic_store_n(&target.sequence, next, __ATOMIC_RELAXED);
+        std::atomic_thread_fence(std::memory_order_release);
+        return target;
+    }
+    
+    // Mark a copy as complete once all of its fields are written
+    template <typename Record>
+    static void finish_write(Record& target) {
+        __atomic_store_n(&target.sequence, target.sequence + 1, __ATOMIC_RELEASE);
+    }
+    
+    // Copy out the newest complete copy of a record; false if neither is
+    template <typename Record>
+    static bool read_newest(const Record* copies, Record* out) {
+        bool found = false;
+        for (int c = 0; c < 2; c++) {
+            uint32_t before = __atomic_load_n(&copies[c].sequence, __ATOMIC_ACQUIRE);
+            if (before == 0 || before % 2 != 0 || (found && before <= out->sequence)) {
+                continue;
+            }
+            Record copy;
+            std::memcpy(&copy, &copies[c], sizeof(copy));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (__atomic_load_n(&copies[c].sequence, __ATOMIC_RELAXED) == before) {
+                copy.sequence = before;
+                *out = copy;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+public:
+    GameSnapshot() : fd(-1), map(nullptr), map_size(0), num_players(0), num_potatoes(0) {}
+    
+    ~GameSnapshot() {
+        close_file();
+    }
+    
+    bool is_open() const { return map != nullptr; }
+    
+    // Create (or truncate) the snapshot file and map it
+    void create(const std::string& path, int players, int hops, int potato_count) {
+        close_file();
+        
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw SnapshotError("Failed to create snapshot file " + path);
+        }
+        
+        map_size = file_size(players, potato_count);
+        if (ftruncate(fd, map_size) < 0) {
+            close_file();
+            throw SnapshotError("Failed to size snapshot file " + path);
+        }
+        
+        void* addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            close_file();
+            throw SnapshotError("Failed to map snapshot file " + path);
+        }
+        map = static_cast<char*>(addr);
+        num_players = players;
+        num_potatoes = potato_count;
+        
+        SnapshotHeader* hdr = header();
+        std::strncpy(hdr->magic, magic(), sizeof(hdr->magic));
+        hdr->num_players = players;
+        hdr->num_hops = hops;
+        hdr->num_potatoes = potato_count;
+        hdr->max_hops = MAX_HOPS;
+        hdr->epoch = 0;
+        hdr->sequence = 0;
+        hdr->commit_ns = 0;
+    }
+    
+    // Record the neighbors a player was last told about
+    void save_player(int player, int left_id, int right_id, bool alive) {
+        SnapshotPlayer& record = begin_write(players() + 2 * player);
+        record.left_id = left_id;
+        record.right_id = right_id;
+        record.alive = alive ? 1 : 0;
+        finish_write(record);
+    }
+    
+    // Record the latest copy of a potato
+    void save_potato(const Potato& potato, bool finished) {
+        if (potato.get_id() < 0 || potato.get_id() >= num_potatoes) {
+            return;
+        }
+        SnapshotPotato& record = begin_write(potatoes() + 2 * potato.get_id());
+        const std::vector<int>& trace = potato.get_trace();
+        int length = std::min(static_cast<int>(trace.size()), MAX_HOPS);
+        
+        record.id = potato.get_id();
+        record.remaining_hops = potato.get_hops();
+        record.epoch = potato.get_epoch();
+        record.finished = finished ? 1 : 0;
+        std::memcpy(record.trace, trace.data(), length * sizeof(int32_t));
+        record.trace_length = length;
+        finish_write(record);
+    }
+    
+    void save_epoch(int epoch) {
+        header()->epoch = epoch;
+    }
+    
+    // Mark the current contents as a complete snapshot and schedule write-back
+    void commit() {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        header()->commit_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+        header()->sequence++;
+        msync(map, map_size, MS_ASYNC);
+    }
+    
+    void close_file() {
+        if (map != nullptr) {
+            msync(map, map_size, MS_SYNC);
+            munmap(map, map_size);
+            map = nullptr;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    
+    // Read a snapshot file back into memory
+    static SnapshotState load(const std::string& path) {
+        int in_fd = open(path.c_str(), O_RDONLY);
+        if (in_fd < 0) {
+            throw SnapshotError("Failed to open snapshot file " + path);
+        }
+        
+        struct stat st;
+        if (fstat(in_fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+            close(in_fd);
+            throw SnapshotError("Snapshot file " + path + " is truncated");
+        }
+        
+        void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        close(in_fd);
+        if (addr == MAP_FAILED) {
+            throw SnapshotError("Failed to map snapshot file " + path);
+        }
+        const char* data = static_cast<const char*>(addr);
+        const SnapshotHeader* hdr = reinterpret_cast<const SnapshotHeader*>(data);
+        
+        if (std::strncmp(hdr->magic, magic(), sizeof(hdr->magic)) != 0 ||
+            hdr->max_hops != MAX_HOPS || hdr->num_hops > MAX_HOPS || hdr->num_players == 0 ||
+            static_cast<size_t>(st.st_size) < file_size(hdr->num_players, hdr->num_potatoes)) {
+            munmap(addr, st.st_size);
+            throw SnapshotError("File " + path + " is not a valid snapshot");
+        }
+        
+        SnapshotState state;
+        state.num_players = hdr->num_players;
+        state.num_hops = hdr->num_hops;
+        state.epoch = hdr->epoch;
+        state.sequence = hdr->sequence;
+        
+        // Every record must have a whole copy with fields that fit the game
+        std::string problem;
+        const SnapshotPlayer* player_records =
+            reinterpret_cast<const SnapshotPlayer*>(data + sizeof(SnapshotHeader));
+        for (int i = 0; i < state.num_players && problem.empty(); i++) {
+            SnapshotPlayer record;
+            if (!read_newest(player_records + 2 * i, &record)) {
+                problem = "player " + std::to_string(i) + " has no complete record";
+            } else if (record.left_id < -1 || record.left_id >= state.num_players ||
+                       record.right_id < -1 || record.right_id >= state.num_players) {
+                problem = "player " + std::to_string(i) + " has a neighbor out of range";
+            }
+            state.players.push_back(record);
+        }
+        
+        const SnapshotPotato* potato_records =
+            reinterpret_cast<const SnapshotPotato*>(player_records + 2 * hdr->num_players);
+        for (uint32_t i = 0; i < hdr->num_potatoes && problem.empty(); i++) {
+            SnapshotPotato record;
+            if (!read_newest(potato_records + 2 * i, &record)) {
+                problem = "potato " + std::to_string(i) + " has no complete record";
+                break;
+            }
+            if (record.id != static_cast<int32_t>(i) || record.remaining_hops < 0 ||
+                record.remaining_hops > state.num_hops || record.trace_length < 0 ||
+                record.trace_length > state.num_hops - record.remaining_hops) {
+                problem = "potato " + std::to_string(i) + " has its ID or hop count out of range";
+                break;
+            }
+            Potato potato(record.remaining_hops, record.id);
+            potato.set_epoch(record.epoch);
+            for (int32_t t = 0; t < record.trace_length; t++) {
+                if (record.trace[t] < 0 || record.trace[t] >= state.num_players) {
+                    problem = "potato " + std::to_string(i) + " has a player ID out of range";
+                    break;
+                }
+                potato.add_to_trace(record.trace[t]);
+            }
+            state.potatoes.push_back(potato);
+            state.finished.push_back(record.finished != 0);
+        }
+        
+        munmap(addr, st.st_size);
+        if (!problem.empty()) {
+            throw SnapshotError("Snapshot file " + path + ": " + problem);
+        }
+        return state;
+    }
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,214 @@
+#ifndef TRACE_CHECK_H
+#define TRACE_CHECK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define TRACE_CHECK_AVX2 1
+#endif
+
+// How the steps of a trace moved around a ring of num_players
+struct TraceSteps {
+    uint64_t left;                // Moves to the left ring neighbor
+    uint64_t right;               // Moves to the right ring neighbor
+    std::vector<size_t> others;   // Hops reached by any other move, or holding a bad ID
+
+    TraceSteps() : left(0), right(0) {}
+};
+
+// Checks a potato's trace (the int array of Potato::get_trace()) against the
+// ring topology and counts visits per player.
+// Step classification is vectorized: AVX2 when the CPU has it, else SSE2,
+// with a scalar loop for the tail and for other targets. Visit counting is a
+// scatter, which SSE2/AVX2 cannot do, so it is scalar, split over several
+// tables to break the dependency between consecutive hops on one player.
+class TraceCheck {
+private:
+    // Scalar step test for hop i (i >= 1)
+    static void check_step(const int* ids, size_t i, int num_players, TraceSteps* steps) {
+        int from = ids[i - 1];
+        int to = ids[i];
+        // Range first: to - from on arbitrary IDs can overflow
+        if (from < 0 || from >= num_players || to < 0 || to >= num_players) {
+            steps->others.push_back(i);
+            return;
+        }
+        int delta = to - from;
+        if (delta == 1 || delta == 1 - num_players) {
+            steps->right++;
+        } else if (delta == -1 || delta == num_players - 1) {
+            steps->left++;
+        } else {
+            steps->others.push_back(i);
+        }
+    }
+
+    static void check_scalar(const int* ids, size_t begin, size_t end, int num_players, TraceSteps* steps) {
+        for (size_t i = begin; i < end; i++) {
+            check_step(ids, i, num_players, steps);
+        }
+    }
+
+    // Lanes that hold -1 in each mask are counted; lanes in neither are
+    // re-checked one at a time so their positions can be recorded
+    static void tally(size_t i, int lanes, unsigned right_bits, unsigned left_bits, TraceSteps* steps) {
+        steps->right += __builtin_popcount(right_bits);
+        steps->left += __builtin_popcount(left_bits);
+        unsigned all = (1u << lanes) - 1;
+        if ((right_bits | left_bits) != all) {
+            for (int lane = 0; lane < lanes; lane++) {
+                if (!((right_bits | left_bits) & (1u << lane))) {
+                    steps->others.push_back(i + lane);
+                }
+            }
+        }
+    }
+
+#if defined(__SSE2__)
+    // Steps for hops [begin, end), four at a time
+    static size_t check_sse2(const int* ids, size_t begin, size_t end, int num_players, TraceSteps* steps) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i last = _mm_set1_epi32(num_players - 1);
+        const __m128i plus_one = _mm_set1_epi32(1);
+        const __m128i minus_one = _mm_set1_epi32(-1);
+        const __m128i wrap_right = _mm_set1_epi32(1 - num_players);
+        const __m128i wrap_left = _mm_set1_epi32(num_players - 1);
+
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m128i from = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i - 1));
+            __m128i to = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i));
+            __m128i delta = _mm_sub_epi32(to, from);
+
+            // Both IDs in [0, num_players)
+            __m128i bad = _mm_or_si128(_mm_cmplt_epi32(from, zero), _mm_cmplt_epi32(to, zero));
+            bad = _mm_or_si128(bad, _mm_cmpgt_epi32(from, last));
+            bad = _mm_or_si128(bad, _mm_cmpgt_epi32(to, last));
+
+            __m128i right = _mm_or_si128(_mm_cmpeq_epi32(delta, plus_one), _mm_cmpeq_epi32(delta, wrap_right));
+            __m128i left = _mm_or_si128(_mm_cmpeq_epi32(delta, minus_one), _mm_cmpeq_epi32(delta, wrap_left));
+            right = _mm_andnot_si128(bad, right);
+            left = _mm_andnot_si128(_mm_or_si128(bad, right), left);
+
+            tally(i, 4, _mm_movemask_ps(_mm_castsi128_ps(right)),
+                  _mm_movemask_ps(_mm_castsi128_ps(left)), steps);
+        }
+        return i;
+    }
+#endif
+
+#if defined(TRACE_CHECK_AVX2)
+    // Steps for hops [begin, end), eight at a time
+    __attribute__((target("avx2")))
+    static size_t check_avx2(const int* ids, size_t begin, size_t end, int num_players, TraceSteps* steps) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i last = _mm256_set1_epi32(num_players - 1);
+        const __m256i plus_one = _mm256_set1_epi32(1);
+        const __m256i minus_one = _mm256_set1_epi32(-1);
+        const __m256i wrap_right = _mm256_set1_epi32(1 - num_players);
+        const __m256i wrap_left = _mm256_set1_epi32(num_players - 1);
+
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256i from = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i - 1));
+            __m256i to = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i));
+            __m256i delta = _mm256_sub_epi32(to, from);
+
+            __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi32(zero, from), _mm256_cmpgt_epi32(zero, to));
+            bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(from, last));
+            bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(to, last));
+
+            __m256i right = _mm256_or_si256(_mm256_cmpeq_epi32(delta, plus_one),
+                                            _mm256_cmpeq_epi32(delta, wrap_right));
+            __m256i left = _mm256_or_si256(_mm256_cmpeq_epi32(delta, minus_one),
+                                           _mm256_cmpeq_epi32(delta, wrap_left));
+            right = _mm256_andnot_si256(bad, right);
+            left = _mm256_andnot_si256(_mm256_or_si256(bad, right), left);
+
+            tally(i, 8, _mm256_movemask_ps(_mm256_castsi256_ps(right)),
+                  _mm256_movemask_ps(_mm256_castsi256_ps(left)), steps);
+        }
+        return i;
+    }
+
+    static bool have_avx2() {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#endif
+
+public:
+    // Classify every step of a trace. With two players both neighbors are
+    // the same player, and its steps count as right.
+    static TraceSteps check_steps(const std::vector<int>& trace, int num_players) {
+        TraceSteps steps;
+        const int* ids = trace.data();
+        size_t end = trace.size();
+        size_t i = 1;
+#if defined(TRACE_CHECK_AVX2)
+        if (have_avx2()) {
+            i = check_avx2(ids, i, end, num_players, &steps);
+        }
+#endif
+#if defined(__SSE2__)
+        i = check_sse2(ids, i, end, num_players, &steps);
+#endif
+        check_scalar(ids, i, end, num_players, &steps);
+        if (!trace.empty() && (trace[0] < 0 || trace[0] >= num_players)) {
+            steps.others.insert(steps.others.begin(), 0);
+        }
+        return steps;
+    }
+
+    // Add one to visits[id] for every hop of a trace; IDs out of range are skipped
+    static void count_visits(const std::vector<int>& trace, std::vector<uint64_t>& visits) {
+        const int* ids = trace.data();
+        size_t count = trace.size();
+        uint32_t num_players = visits.size();
+
+        // Short traces, or rings too big for extra tables to pay off
+        if (count < 4 * static_cast<size_t>(num_players) || num_players > (1u << 16)) {
+            for (size_t i = 0; i < count; i++) {
+                if (static_cast<uint32_t>(ids[i]) < num_players) {
+                    visits[ids[i]]++;
+                }
+            }
+            return;
+        }
+
+        std::vector<uint32_t> tables(4 * static_cast<size_t>(num_players), 0);
+        uint32_t* t0 = tables.data();
+        uint32_t* t1 = t0 + num_players;
+        uint32_t* t2 = t1 + num_players;
+        uint32_t* t3 = t2 + num_players;
+        size_t i = 0;
+        while (i < count) {
+            // Flush before a 32-bit counter could overflow
+            size_t block_end = std::min(count, i + (static_cast<size_t>(1) << 31));
+            for (; i + 4 <= block_end; i += 4) {
+                uint32_t a = ids[i], b = ids[i + 1], c = ids[i + 2], d = ids[i + 3];
+                t0[a < num_players ? a : 0] += a < num_players;
+                t1[b < num_players ? b : 0] += b < num_players;
+                t2[c < num_players ? c : 0] += c < num_players;
+                t3[d < num_players ? d : 0] += d < num_players;
+            }
+            for (; i < block_end; i++) {
+                uint32_t a = ids[i];
+                t0[a < num_players ? a : 0] += a < num_players;
+            }
+            for (uint32_t p = 0; p < num_players; p++) {
+                visits[p] += static_cast<uint64_t>(t0[p]) + t1[p] + t2[p] + t3[p];
+                t0[p] = t1[p] = t2[p] = t3[p] = 0;
+            }
+        }
+    }
+};
+
+#endif // TRACE_CHECK_H
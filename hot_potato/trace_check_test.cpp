@@ -0,0 +1,76 @@
+#include <iostream>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+#include <random>
+
+#include "trace_check.h"
+
+// Step classification done the slow way, with the difference in long long
+static TraceSteps reference_steps(const std::vector<int>& trace, int num_players) {
+    TraceSteps steps;
+    for (size_t i = 0; i < trace.size(); i++) {
+        long long to = trace[i];
+        bool in_range = to >= 0 && to < num_players;
+        if (i == 0) {
+            if (!in_range) {
+                steps.others.push_back(i);
+            }
+            continue;
+        }
+        long long from = trace[i - 1];
+        in_range = in_range && from >= 0 && from < num_players;
+        long long delta = to - from;
+        if (in_range && (delta == 1 || delta == 1 - num_players)) {
+            steps.right++;
+        } else if (in_range && (delta == -1 || delta == num_players - 1)) {
+            steps.left++;
+        } else {
+            steps.others.push_back(i);
+        }
+    }
+    return steps;
+}
+
+// Put an extreme ID at every position of traces long enough to reach the
+// AVX2, SSE2 and scalar loops and each of their tails, and check that
+// check_steps agrees with the reference. Build with -fsanitize=undefined to
+// catch overflow on the way.
+int main() {
+    const int extremes[] = { INT_MIN, INT_MIN + 1, -1, INT_MAX - 1, INT_MAX };
+    const int ring_sizes[] = { 1, 2, 3, 7, INT_MAX };
+    std::mt19937 rng(1);
+    int checked = 0;
+    int failed = 0;
+
+    for (size_t r = 0; r < sizeof(ring_sizes) / sizeof(ring_sizes[0]); r++) {
+        int num_players = ring_sizes[r];
+        for (size_t length = 1; length <= 40; length++) {
+            // A legal walk around the ring to plant the extreme IDs in
+            std::vector<int> walk(length);
+            walk[0] = 0;
+            for (size_t i = 1; i < length; i++) {
+                long long next = walk[i - 1] + ((rng() & 1) ? 1 : -1);
+                walk[i] = static_cast<int>((next + num_players) % num_players);
+            }
+            for (size_t pos = 0; pos < length; pos++) {
+                for (size_t e = 0; e < sizeof(extremes) / sizeof(extremes[0]); e++) {
+                    std::vector<int> trace = walk;
+                    trace[pos] = extremes[e];
+                    TraceSteps got = TraceCheck::check_steps(trace, num_players);
+                    TraceSteps want = reference_steps(trace, num_players);
+                    checked++;
+                    if (got.left != want.left || got.right != want.right || got.others != want.others) {
+                        if (failed++ < 10) {
+                            std::cerr << "Mismatch: " << num_players << " players, length " << length
+                                      << ", ID " << extremes[e] << " at " << pos << std::endl;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "Checked " << checked << " traces, " << failed << " mismatches" << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
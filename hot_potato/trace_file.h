@@ -0,0 +1,338 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Exception class for trace file operations
+class TraceFileError : public std::runtime_error {
+public:
+    TraceFileError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// On-disk layout of a binary trace file:
+//   TraceFileHeader | record* | TraceIndexEntry[record_count]
+// A record is a TraceRecordHeader followed by hop_count player IDs, each
+// id_width bytes wide, padded to 8 bytes. Records are only ever appended;
+// the index is written when the file is closed, and readers fall back to a
+// sequential scan if it is missing (e.g. after a crash).
+struct TraceFileHeader {
+    char magic[8];          // "HPTRACE"
+    uint32_t version;
+    uint32_t flags;         // TRACE_HAS_TIMESTAMPS
+    uint32_t num_players;
+    uint32_t id_width;      // Bytes per packed player ID (2 or 4)
+    uint64_t record_count;
+    uint64_t data_end;      // Offset just past the last complete record
+    uint64_t index_offset;  // Offset of the index, 0 until the file is closed
+};
+
+// Per-record timestamps are valid
+static const uint32_t TRACE_HAS_TIMESTAMPS = 1;
+
+// Most players a trace file may describe; readers keep per-player counters
+static const uint32_t TRACE_MAX_PLAYERS = 1u << 22;
+
+// Bytes per packed player ID for a ring of num_players
+static inline uint32_t trace_id_width(uint32_t num_players) {
+    return num_players <= 65536 ? 2 : 4;
+}
+
+struct TraceRecordHeader {
+    uint32_t potato_id;
+    uint32_t hop_count;
+    uint64_t start_ns;      // When the potato was launched (wall clock)
+    uint64_t end_ns;        // When it came back, 0 if it never did
+};
+
+struct TraceIndexEntry {
+    uint32_t potato_id;
+    uint32_t hop_count;
+    uint64_t offset;        // Offset of the record's TraceRecordHeader
+};
+
+// Wall-clock time in nanoseconds, as stored in trace records
+static inline uint64_t trace_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+// Append-only, memory-mapped trace writer
+class TraceWriter {
+private:
+    int fd;
+    char* map;
+    size_t capacity;
+    std::vector<TraceIndexEntry> index;
+    
+    static const size_t INITIAL_CAPACITY = 1 << 20;
+    
+    TraceFileHeader* header() const { return reinterpret_cast<TraceFileHeader*>(map); }
+    
+    // Grow the file and mapping so at least `needed` bytes fit
+    void reserve(size_t needed) {
+        if (needed <= capacity) {
+            return;
+        }
+        size_t new_capacity = capacity;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        if (ftruncate(fd, new_capacity) < 0) {
+            throw TraceFileError("Failed to grow trace file");
+        }
+        void* addr = mremap(map, capacity, new_capacity, MREMAP_MAYMOVE);
+        if (addr == MAP_FAILED) {
+            throw TraceFileError("Failed to remap trace file");
+        }
+        map = static_cast<char*>(addr);
+        capacity = new_capacity;
+    }
+
+public:
+    TraceWriter() : fd(-1), map(nullptr), capacity(0) {}
+    
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+    
+    ~TraceWriter() {
+        try {
+            close_file();
+        } catch (const TraceFileError& e) {
+            // Nothing more can be done while being destroyed
+        }
+    }
+    
+    bool is_open() const { return map != nullptr; }
+    
+    // Create (or truncate) the trace file and map it
+    void create(const std::string& path, int num_players, bool timestamps) {
+        if (num_players <= 0 || static_cast<uint32_t>(num_players) > TRACE_MAX_PLAYERS) {
+            throw TraceFileError("Trace files hold at most " + std::to_string(TRACE_MAX_PLAYERS) + " players");
+        }
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw TraceFileError("Failed to create trace file " + path);
+        }
+        capacity = INITIAL_CAPACITY;
+        if (ftruncate(fd, capacity) < 0) {
+            close(fd);
+            fd = -1;
+            throw TraceFileError("Failed to size trace file " + path);
+        }
+        void* addr = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            fd = -1;
+            throw TraceFileError("Failed to map trace file " + path);
+        }
+        map = static_cast<char*>(addr);
+        
+        TraceFileHeader* hdr = header();
+        std::strncpy(hdr->magic, "HPTRACE", sizeof(hdr->magic));
+        hdr->version = 1;
+        hdr->flags = timestamps ? TRACE_HAS_TIMESTAMPS : 0;
+        hdr->num_players = num_players;
+        hdr->id_width = trace_id_width(num_players);
+        hdr->record_count = 0;
+        hdr->data_end = sizeof(TraceFileHeader);
+        hdr->index_offset = 0;
+    }
+    
+    // Append one potato's trace
+    void append(int potato_id, const std::vector<int>& trace, uint64_t start_ns, uint64_t end_ns) {
+        uint32_t width = header()->id_width;
+        size_t payload = (trace.size() * width + 7) & ~static_cast<size_t>(7);
+        size_t offset = header()->data_end;
+        reserve(offset + sizeof(TraceRecordHeader) + payload);
+        
+        TraceRecordHeader* record = reinterpret_cast<TraceRecordHeader*>(map + offset);
+        record->potato_id = potato_id;
+        record->hop_count = trace.size();
+        bool timestamps = (header()->flags & TRACE_HAS_TIMESTAMPS) != 0;
+        record->start_ns = timestamps ? start_ns : 0;
+        record->end_ns = timestamps ? end_ns : 0;
+        
+        char* ids = map + offset + sizeof(TraceRecordHeader);
+        if (width == 2) {
+            uint16_t* packed = reinterpret_cast<uint16_t*>(ids);
+            for (size_t i = 0; i < trace.size(); i++) {
+                packed[i] = static_cast<uint16_t>(trace[i]);
+            }
+        } else {
+            uint32_t* packed = reinterpret_cast<uint32_t*>(ids);
+            for (size_t i = 0; i < trace.size(); i++) {
+                packed[i] = static_cast<uint32_t>(trace[i]);
+            }
+        }
+        
+        // Publish the record only once it is complete
+        header()->data_end = offset + sizeof(TraceRecordHeader) + payload;
+        header()->record_count++;
+        
+        TraceIndexEntry entry;
+        entry.potato_id = potato_id;
+        entry.hop_count = trace.size();
+        entry.offset = offset;
+        index.push_back(entry);
+    }
+    
+    // Write the index, trim the file and unmap it
+    void close_file() {
+        if (map == nullptr) {
+            return;
+        }
+        size_t index_offset = header()->data_end;
+        size_t end = index_offset + index.size() * sizeof(TraceIndexEntry);
+        reserve(end);
+        if (!index.empty()) {
+            std::memcpy(map + index_offset, index.data(), index.size() * sizeof(TraceIndexEntry));
+        }
+        header()->index_offset = index_offset;
+        
+        msync(map, end, MS_SYNC);
+        munmap(map, capacity);
+        map = nullptr;
+        if (ftruncate(fd, end) < 0) {
+            close(fd);
+            fd = -1;
+            throw TraceFileError("Failed to trim trace file");
+        }
+        close(fd);
+        fd = -1;
+    }
+};
+
+// Read-only view of a trace file
+class TraceFileReader {
+private:
+    const char* map;
+    size_t size;
+    std::vector<TraceIndexEntry> records;
+    
+    // Bytes of packed IDs after a record header, including padding
+    size_t payload_size(uint32_t hop_count) const {
+        return (static_cast<size_t>(hop_count) * header()->id_width + 7) & ~static_cast<size_t>(7);
+    }
+    
+    // True if a record with this many hops at offset lies wholly inside the
+    // data area. Written so that no sum can wrap around.
+    bool record_fits(uint64_t offset, uint32_t hop_count) const {
+        uint64_t data_end = header()->data_end;
+        if (offset < sizeof(TraceFileHeader) || offset % 8 != 0 || offset > data_end ||
+            data_end - offset < sizeof(TraceRecordHeader)) {
+            return false;
+        }
+        return payload_size(hop_count) <= data_end - offset - sizeof(TraceRecordHeader);
+    }
+    
+    // Rebuild the index by walking the records (file was never closed)
+    void scan_records() {
+        const TraceFileHeader* hdr = header();
+        size_t offset = sizeof(TraceFileHeader);
+        while (offset + sizeof(TraceRecordHeader) <= hdr->data_end) {
+            const TraceRecordHeader* record = reinterpret_cast<const TraceRecordHeader*>(map + offset);
+            if (!record_fits(offset, record->hop_count)) {
+                throw TraceFileError("Trace record at offset " + std::to_string(offset) + " is corrupt");
+            }
+            TraceIndexEntry entry;
+            entry.potato_id = record->potato_id;
+            entry.hop_count = record->hop_count;
+            entry.offset = offset;
+            records.push_back(entry);
+            offset += sizeof(TraceRecordHeader) + payload_size(record->hop_count);
+        }
+    }
+    
+    // Check every index entry against the record it points at
+    void check_index() const {
+        for (const TraceIndexEntry& entry : records) {
+            if (!record_fits(entry.offset, entry.hop_count)) {
+                throw TraceFileError("Trace index entry for potato " + std::to_string(entry.potato_id) +
+                                     " points outside the data");
+            }
+            const TraceRecordHeader* record = reinterpret_cast<const TraceRecordHeader*>(map + entry.offset);
+            if (record->hop_count != entry.hop_count || record->potato_id != entry.potato_id) {
+                throw TraceFileError("Trace index entry for potato " + std::to_string(entry.potato_id) +
+                                     " does not match its record");
+            }
+        }
+    }
+
+public:
+    TraceFileReader(const std::string& path) : map(nullptr), size(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw TraceFileError("Failed to open trace file " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(TraceFileHeader)) {
+            close(fd);
+            throw TraceFileError("Trace file " + path + " is truncated");
+        }
+        size = st.st_size;
+        void* addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            throw TraceFileError("Failed to map trace file " + path);
+        }
+        map = static_cast<const char*>(addr);
+        
+        const TraceFileHeader* hdr = header();
+        if (std::strncmp(hdr->magic, "HPTRACE", sizeof(hdr->magic)) != 0 || hdr->version != 1 ||
+            hdr->num_players == 0 || hdr->num_players > TRACE_MAX_PLAYERS ||
+            hdr->id_width != trace_id_width(hdr->num_players) || hdr->data_end > size) {
+            munmap(const_cast<char*>(map), size);
+            throw TraceFileError("File " + path + " is not a valid trace file");
+        }
+        
+        try {
+            if (hdr->index_offset != 0 && hdr->index_offset % 8 == 0 && hdr->index_offset <= size &&
+                hdr->record_count <= (size - hdr->index_offset) / sizeof(TraceIndexEntry)) {
+                const TraceIndexEntry* index = reinterpret_cast<const TraceIndexEntry*>(map + hdr->index_offset);
+                records.assign(index, index + hdr->record_count);
+                check_index();
+            } else {
+                scan_records();
+            }
+        } catch (const TraceFileError& e) {
+            munmap(const_cast<char*>(map), size);
+            throw TraceFileError("File " + path + ": " + e.what());
+        }
+    }
+    
+    TraceFileReader(const TraceFileReader&) = delete;
+    TraceFileReader& operator=(const TraceFileReader&) = delete;
+    
+    ~TraceFileReader() {
+        munmap(const_cast<char*>(map), size);
+    }
+    
+    const TraceFileHeader* header() const { return reinterpret_cast<const TraceFileHeader*>(map); }
+    
+    size_t record_count() const { return records.size(); }
+    
+    const TraceIndexEntry& entry(size_t i) const { return records[i]; }
+    
+    const TraceRecordHeader& record(size_t i) const {
+        return *reinterpret_cast<const TraceRecordHeader*>(map + records[i].offset);
+    }
+    
+    // Packed player IDs of record i; id_width() bytes each
+    const void* player_ids(size_t i) const {
+        return map + records[i].offset + sizeof(TraceRecordHeader);
+    }
+    
+    uint32_t id_width() const { return header()->id_width; }
+};
+
+#endif // TRACE_FILE_H
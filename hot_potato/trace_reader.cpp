@@ -0,0 +1,158 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <thread>
+
+#include "trace_file.h"
+
+// Statistics gathered from a range of trace records
+struct TraceStats {
+    std::vector<uint64_t> visits;  // Hops that landed on each player
+    std::map<uint32_t, uint64_t> lengths;  // Potatoes by number of hops taken
+    uint64_t potatoes;
+    uint64_t hops;
+    uint64_t left_steps;           // Moves to the left ring neighbor
+    uint64_t right_steps;          // Moves to the right ring neighbor
+    uint64_t other_steps;          // Moves between non-adjacent players (ring repairs)
+    uint32_t min_hops;
+    uint32_t max_hops;
+    
+    TraceStats(int num_players)
+        : visits(num_players, 0), potatoes(0), hops(0),
+          left_steps(0), right_steps(0), other_steps(0),
+          min_hops(UINT32_MAX), max_hops(0) {}
+    
+    void merge(const TraceStats& other) {
+        for (size_t i = 0; i < visits.size(); i++) {
+            visits[i] += other.visits[i];
+        }
+        for (const std::pair<const uint32_t, uint64_t>& length : other.lengths) {
+            lengths[length.first] += length.second;
+        }
+        potatoes += other.potatoes;
+        hops += other.hops;
+        left_steps += other.left_steps;
+        right_steps += other.right_steps;
+        other_steps += other.other_steps;
+        min_hops = std::min(min_hops, other.min_hops);
+        max_hops = std::max(max_hops, other.max_hops);
+    }
+};
+
+// Scan the player IDs of one record into the statistics
+template <typename IdType>
+static void scan_ids(const IdType* ids, uint32_t count, uint32_t num_players, TraceStats& stats) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i] < num_players) {
+            stats.visits[ids[i]]++;
+        }
+        if (i == 0) {
+            continue;
+        }
+        if (ids[i] >= num_players || ids[i - 1] >= num_players) {
+            stats.other_steps++;
+            continue;
+        }
+        uint32_t step = (ids[i] + num_players - ids[i - 1]) % num_players;
+        if (step == 1) {
+            stats.right_steps++;
+        } else if (step == num_players - 1) {
+            stats.left_steps++;
+        } else {
+            stats.other_steps++;
+        }
+    }
+}
+
+// Scan records [begin, end) of the trace file
+static void scan_records(const TraceFileReader& reader, size_t begin, size_t end, TraceStats* stats) {
+    uint32_t num_players = reader.header()->num_players;
+    for (size_t r = begin; r < end; r++) {
+        uint32_t count = reader.entry(r).hop_count;
+        if (reader.id_width() == 2) {
+            scan_ids(static_cast<const uint16_t*>(reader.player_ids(r)), count, num_players, *stats);
+        } else {
+            scan_ids(static_cast<const uint32_t*>(reader.player_ids(r)), count, num_players, *stats);
+        }
+        stats->potatoes++;
+        stats->hops += count;
+        stats->min_hops = std::min(stats->min_hops, count);
+        stats->max_hops = std::max(stats->max_hops, count);
+        stats->lengths[count]++;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Check command line arguments
+    if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "--threads")) {
+        std::cerr << "Usage: " << argv[0] << " <trace_file> [--threads N]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    int num_threads = argc == 4 ? std::atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    if (num_threads < 1) {
+        std::cerr << "Error: threads must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    try {
+        TraceFileReader reader(argv[1]);
+        const TraceFileHeader* header = reader.header();
+        int num_players = header->num_players;
+        
+        // Split the records evenly between threads, each with private counters
+        size_t records = reader.record_count();
+        num_threads = std::min<size_t>(num_threads, std::max<size_t>(records, 1));
+        std::vector<TraceStats> partial(num_threads, TraceStats(num_players));
+        std::vector<std::thread> workers;
+        for (int t = 0; t < num_threads; t++) {
+            size_t begin = records * t / num_threads;
+            size_t end = records * (t + 1) / num_threads;
+            workers.push_back(std::thread(scan_records, std::cref(reader), begin, end, &partial[t]));
+        }
+        
+        TraceStats total(num_players);
+        for (int t = 0; t < num_threads; t++) {
+            workers[t].join();
+            total.merge(partial[t]);
+        }
+        
+        std::cout << "Potatoes = " << total.potatoes << std::endl;
+        std::cout << "Players = " << num_players << std::endl;
+        std::cout << "Hops = " << total.hops << std::endl;
+        if (total.potatoes > 0) {
+            std::cout << "Hops per potato: min " << total.min_hops << ", max " << total.max_hops
+                      << ", mean " << static_cast<double>(total.hops) / total.potatoes << std::endl;
+            std::cout << "Hop histogram:" << std::endl;
+            for (const std::pair<const uint32_t, uint64_t>& length : total.lengths) {
+                std::cout << "  " << length.first << " hops: " << length.second << " potatoes" << std::endl;
+            }
+        }
+        std::cout << "Steps: left " << total.left_steps << ", right " << total.right_steps
+                  << ", other " << total.other_steps << std::endl;
+        
+        if (header->flags & TRACE_HAS_TIMESTAMPS) {
+            for (size_t r = 0; r < records; r++) {
+                const TraceRecordHeader& record = reader.record(r);
+                if (record.end_ns != 0) {
+                    std::cout << "Potato " << record.potato_id << ": " << record.hop_count << " hops in "
+                              << (record.end_ns - record.start_ns) / 1e6 << " ms" << std::endl;
+                }
+            }
+        }
+        
+        std::cout << "Visits per player:" << std::endl;
+        for (int i = 0; i < num_players; i++) {
+            std::cout << "  Player " << i << ": " << total.visits[i] << std::endl;
+        }
+    } catch (const TraceFileError& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}